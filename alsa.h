@@ -0,0 +1,279 @@
+//
+// Native ALSA backend for playing live
+//
+//	convert phaser --alsa=hw:0 [--period=16] [--periods=2] [--priority=80]
+//
+// reads the ADC and writes the DAC of the same card directly through
+// the mmap'ed ring buffers, instead of going through a pipe and ffplay
+// with unknown amounts of buffering in between. The capture and the
+// playback streams are linked so that they start together and run off
+// the same clock.
+//
+// The round trip is one capture period plus the playback buffer
+// ('periods' periods), so 16 samples with 2 periods is 1ms at 48kHz.
+// The audio thread runs SCHED_FIFO with all memory locked, so that
+// it doesn't get paged out or preempted by normal processes.
+//
+// With --latency, the effects are bypassed: it sends a click every
+// quarter second and times how long it takes to come back in, so
+// with the output looped back to the input that measures the actual
+// round-trip latency including the converters.
+//
+// Build with 'make ALSA=1'.
+//
+#include <alsa/asoundlib.h>
+#include <limits.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+static const char *alsa_device;
+static int alsa_period = 16, alsa_periods = 2;
+static int alsa_priority = 80;
+static int alsa_latency;
+
+// Parse the ALSA-specific options, returns non-zero if it was one
+static int alsa_option(const char *arg)
+{
+	if (!strncmp(arg, "--alsa=", 7)) {
+		alsa_device = arg+7;
+		return 1;
+	}
+	if (!strncmp(arg, "--period=", 9)) {
+		alsa_period = atoi(arg+9);
+		return 1;
+	}
+	if (!strncmp(arg, "--periods=", 10)) {
+		alsa_periods = atoi(arg+10);
+		return 1;
+	}
+	if (!strncmp(arg, "--priority=", 11)) {
+		alsa_priority = atoi(arg+11);
+		return 1;
+	}
+	if (!strcmp(arg, "--latency")) {
+		alsa_latency = 1;
+		return 1;
+	}
+	return 0;
+}
+
+static void alsa_fatal(const char *what, int err)
+{
+	fprintf(stderr, "ALSA %s: %s\n", what, snd_strerror(err));
+	exit(1);
+}
+
+static unsigned int alsa_channels;
+
+static snd_pcm_t *alsa_open(const char *name, snd_pcm_stream_t stream, unsigned int channels)
+{
+	snd_pcm_hw_params_t *hw;
+	snd_pcm_sw_params_t *sw;
+	snd_pcm_uframes_t period = alsa_period;
+	unsigned int rate = (unsigned int) SAMPLES_PER_SEC, periods = alsa_periods;
+	snd_pcm_t *pcm;
+	int err;
+
+	err = snd_pcm_open(&pcm, name, stream, 0);
+	if (err < 0)
+		alsa_fatal(name, err);
+
+	snd_pcm_hw_params_alloca(&hw);
+	snd_pcm_hw_params_any(pcm, hw);
+
+	// Hardware devices are often stereo only. If the card has
+	// more channels than we process, the extra outputs repeat the
+	// processed ones; if it has fewer, the processing wraps around
+	// the inputs it does have
+	if ((err = snd_pcm_hw_params_set_access(pcm, hw, SND_PCM_ACCESS_MMAP_INTERLEAVED)) < 0 ||
+	    (err = snd_pcm_hw_params_set_format(pcm, hw, SND_PCM_FORMAT_S32_LE)) < 0 ||
+	    (err = snd_pcm_hw_params_set_channels_near(pcm, hw, &channels)) < 0 ||
+	    (err = snd_pcm_hw_params_set_rate(pcm, hw, rate, 0)) < 0 ||
+	    (err = snd_pcm_hw_params_set_period_size_near(pcm, hw, &period, 0)) < 0 ||
+	    (err = snd_pcm_hw_params_set_periods_near(pcm, hw, &periods, 0)) < 0 ||
+	    (err = snd_pcm_hw_params(pcm, hw)) < 0)
+		alsa_fatal("hw params", err);
+
+	if (alsa_channels && channels != alsa_channels) {
+		fprintf(stderr, "ALSA: capture and playback channel counts differ\n");
+		exit(1);
+	}
+	alsa_channels = channels;
+
+	// We start the streams by hand
+	snd_pcm_sw_params_alloca(&sw);
+	snd_pcm_sw_params_current(pcm, sw);
+	if ((err = snd_pcm_sw_params_set_start_threshold(pcm, sw, LONG_MAX)) < 0 ||
+	    (err = snd_pcm_sw_params_set_avail_min(pcm, sw, period)) < 0 ||
+	    (err = snd_pcm_sw_params(pcm, sw)) < 0)
+		alsa_fatal("sw params", err);
+
+	if (stream == SND_PCM_STREAM_PLAYBACK) {
+		fprintf(stderr, "ALSA %s: %u channel(s), period %lu, %u periods, "
+			"round trip %.2f ms\n", name, channels, (unsigned long) period, periods,
+			(period + period * periods) / SAMPLES_PER_MSEC);
+		alsa_period = period;
+		alsa_periods = periods;
+	}
+	return pcm;
+}
+
+// Fill the playback buffer with silence and start both streams
+static void alsa_start(snd_pcm_t *capture, snd_pcm_t *playback)
+{
+	const snd_pcm_channel_area_t *areas;
+	snd_pcm_uframes_t offset, frames = alsa_period * alsa_periods;
+	int err;
+
+	if ((err = snd_pcm_prepare(playback)) < 0 ||
+	    (err = snd_pcm_mmap_begin(playback, &areas, &offset, &frames)) < 0)
+		alsa_fatal("prefill", err);
+	snd_pcm_areas_silence(areas, offset, alsa_channels, frames, SND_PCM_FORMAT_S32_LE);
+	snd_pcm_mmap_commit(playback, offset, frames);
+
+	if ((err = snd_pcm_start(capture)) < 0)
+		alsa_fatal("start", err);
+}
+
+static inline s32 *alsa_sample(const snd_pcm_channel_area_t *area, snd_pcm_uframes_t frame)
+{
+	return (s32 *) ((char *) area->addr + (area->first + frame * area->step) / 8);
+}
+
+//
+// The --latency test: replace the audio with a click every quarter
+// second, and look for it coming back in over a tenth of full scale
+//
+#define LATENCY_INTERVAL 12000
+#define LATENCY_LEVEL 0x0ccccccc
+#define LATENCY_RUNS 20
+
+static struct {
+	u32 sent, clock;
+	int waiting, runs;
+	int min, max, sum;
+} latency;
+
+// Only the first of 'channels' interleaved channels is used
+static void latency_block(const s32 *in, s32 *out, int n, int channels)
+{
+	for (int i = 0; i < n; i++, latency.clock++) {
+		s32 x = in[i*channels];
+
+		if (latency.waiting && (x > LATENCY_LEVEL || x < -LATENCY_LEVEL)) {
+			int d = latency.clock - latency.sent;
+
+			fprintf(stderr, "Round trip %d samples (%.3f ms)\n", d, d / SAMPLES_PER_MSEC);
+			if (!latency.runs || d < latency.min)
+				latency.min = d;
+			if (d > latency.max)
+				latency.max = d;
+			latency.sum += d;
+			latency.runs++;
+			latency.waiting = 0;
+		}
+
+		s32 click = 0;
+		if (!(latency.clock % LATENCY_INTERVAL)) {
+			click = 0x40000000;
+			latency.sent = latency.clock;
+			latency.waiting = 1;
+		}
+		for (int ch = 0; ch < channels; ch++)
+			out[i*channels + ch] = click;
+	}
+}
+
+// Runs until killed, or until the latency test is done
+static int alsa_run(struct render *r)
+{
+	snd_pcm_t *capture = alsa_open(alsa_device, SND_PCM_STREAM_CAPTURE, r->channels);
+	snd_pcm_t *playback = alsa_open(alsa_device, SND_PCM_STREAM_PLAYBACK, r->channels);
+	struct sched_param sp = { .sched_priority = alsa_priority };
+	s32 input[BLOCKSIZE * MAX_CHANNELS], output[BLOCKSIZE * MAX_CHANNELS];
+	int rc = r->channels;
+	int err, xruns = 0;
+
+	if (mlockall(MCL_CURRENT | MCL_FUTURE))
+		perror("mlockall");
+	if (sched_setscheduler(0, SCHED_FIFO, &sp))
+		perror("SCHED_FIFO");
+
+	// Fault in the stack we'll be using while it's locked
+	volatile char stack[65536];
+	memset((char *) stack, 0, sizeof(stack));
+
+	if ((err = snd_pcm_link(capture, playback)) < 0)
+		alsa_fatal("link", err);
+	alsa_start(capture, playback);
+
+	while (!alsa_latency || latency.runs < LATENCY_RUNS) {
+		const snd_pcm_channel_area_t *in_areas, *out_areas;
+		snd_pcm_uframes_t in_off, out_off, frames, out_frames;
+		snd_pcm_sframes_t in_avail = snd_pcm_avail_update(capture);
+		snd_pcm_sframes_t out_avail = snd_pcm_avail_update(playback);
+
+		if (in_avail < 0 || out_avail < 0) {
+			// Overrun or underrun: start over with a fresh buffer
+			xruns++;
+			snd_pcm_drop(capture);
+			snd_pcm_prepare(capture);
+			alsa_start(capture, playback);
+			continue;
+		}
+		if (in_avail < alsa_period) {
+			snd_pcm_wait(capture, 1000);
+			continue;
+		}
+
+		// The playback buffer starts out full, and the DAC can be
+		// a little behind the ADC: without room for a period there
+		// would be nothing to do but go round again, spinning at
+		// SCHED_FIFO priority until its pointer moves
+		if (out_avail < alsa_period) {
+			snd_pcm_wait(playback, 1000);
+			continue;
+		}
+
+		frames = BLOCKSIZE;
+		if (frames > (snd_pcm_uframes_t) in_avail)
+			frames = in_avail;
+		if (frames > (snd_pcm_uframes_t) out_avail)
+			frames = out_avail;
+		if ((err = snd_pcm_mmap_begin(capture, &in_areas, &in_off, &frames)) < 0)
+			alsa_fatal("capture", err);
+		out_frames = frames;
+		if ((err = snd_pcm_mmap_begin(playback, &out_areas, &out_off, &out_frames)) < 0)
+			alsa_fatal("playback", err);
+
+		// Either side may wrap around the end of its ring first
+		if (frames > out_frames)
+			frames = out_frames;
+
+		for (int ch = 0; ch < rc; ch++)
+			for (int i = 0; i < frames; i++)
+				input[i*rc + ch] = *alsa_sample(in_areas + ch % alsa_channels, in_off + i);
+
+		if (alsa_latency)
+			latency_block(input, output, frames, rc);
+		else
+			render_block(r, input, output, frames);
+
+		for (int ch = 0; ch < alsa_channels; ch++)
+			for (int i = 0; i < frames; i++)
+				*alsa_sample(out_areas + ch, out_off + i) = output[i*rc + ch % rc];
+
+		snd_pcm_mmap_commit(capture, in_off, frames);
+		snd_pcm_mmap_commit(playback, out_off, frames);
+	}
+
+	if (latency.runs)
+		fprintf(stderr, "Round trip min %d, max %d, average %.1f samples\n",
+			latency.min, latency.max, (double) latency.sum / latency.runs);
+	if (xruns)
+		fprintf(stderr, "%d xruns\n", xruns);
+
+	snd_pcm_close(capture);
+	snd_pcm_close(playback);
+	return 0;
+}
@@ -4,10 +4,10 @@
 // mainly for testing the LFO (and generating signals
 // for testing other effects)
 //
-static struct {
+struct am_state {
 	struct lfo_state base_lfo, mod_lfo;
 	float depth, volume;
-} am;
+};
 
 static inline void am_describe(float pot[4])
 {
@@ -17,19 +17,36 @@ static inline void am_describe(float pot[4])
 	fprintf(stderr, " lfo=%g Hz\n", 1 + 10*pot[3]);
 }
 
-static inline void am_init(float pot[4])
+static inline void am_init(struct am_state *am, float pot[4])
 {
-	am.volume = pot[0];
-	set_lfo_freq(&am.base_lfo, pot_frequency(pot[1]));
-	am.depth = pot[2];
-	set_lfo_freq(&am.mod_lfo, 1 + 10*pot[3]); // 1..11 Hz
+	am->volume = pot[0];
+	set_lfo_freq(&am->base_lfo, pot_frequency(pot[1]));
+	am->depth = pot[2];
+	set_lfo_freq(&am->mod_lfo, 1 + 10*pot[3]); // 1..11 Hz
 }
 
-static inline float am_step(float in)
+static inline float am_step(struct am_state *am, float in)
 {
-	float val = lfo_step(&am.base_lfo, lfo_sinewave);
-	float mod = lfo_step(&am.mod_lfo, lfo_sinewave);
-	float multiplier = 1 + mod * am.depth;
+	float val = lfo_step(&am->base_lfo, lfo_sinewave);
+	float mod = lfo_step(&am->mod_lfo, lfo_sinewave);
+	float multiplier = 1 + mod * am->depth;
 
-	return val * multiplier * am.volume;
+	return val * multiplier * am->volume;
 }
+
+static void am_block(struct am_state *am, const float *in, float *out, int n)
+{
+	float mod[EFFECT_CHUNK];
+
+	while (n > 0) {
+		int len = n < EFFECT_CHUNK ? n : EFFECT_CHUNK;
+
+		lfo_fill(&am->base_lfo, lfo_sinewave, out, len);
+		lfo_fill(&am->mod_lfo, lfo_sinewave, mod, len);
+		for (int i = 0; i < len; i++)
+			out[i] = out[i] * (1 + mod[i] * am->depth) * am->volume;
+		out += len; n -= len;
+	}
+}
+
+DEFINE_EFFECT(am);
@@ -0,0 +1,412 @@
+//
+// Batch rendering: every input with every pot preset, in parallel
+//
+//	convert --batch=DIR [--jobs=N] [--preset=p,p,..] [--sweep=pot:from:to:steps]
+//		effect[,effect..] [pot..] input [input..]
+//
+// renders each combination to DIR/<input>-<n>.raw, and writes
+// DIR/index.txt with one line per output file: the file name, the
+// input, and all the pots of the chain. Inputs with the same name in
+// different directories would then clash, so that's an error.
+//
+// The presets start out as the pots given the usual way. Each
+// --preset replaces them with a list of pots across the chain (as
+// many as given, the rest stay), and then each --sweep multiplies
+// every preset by 'steps' values from 'from' to 'to' of pot 'pot'
+// (again counted across the whole chain). So
+//
+//	convert --batch=out phaser --sweep=0:0:1:5 --sweep=3:0:1:5 *.raw
+//
+// does a 5x5 grid of the phaser LFO and Q over every file.
+//
+// The inputs are read (or mapped) once, and shared by all the
+// renders. Each render has a complete chain of its own, and each
+// worker thread its own delay lines, so they don't share any
+// effect state. There are --jobs workers, one per CPU by default.
+//
+#define MAX_SWEEPS 8
+
+static const char *batch_dir;
+static int batch_jobs;
+
+struct batch_input {
+	const char *name;
+	const s32 *data;
+	size_t samples;
+};
+
+static struct batch_input *batch_inputs;
+static int batch_nr_inputs;
+
+static float (*batch_presets)[4*MAX_CHAIN];
+static int batch_nr_presets;
+
+static struct {
+	int pot, steps;
+	float from, to;
+} batch_sweeps[MAX_SWEEPS];
+static int batch_nr_sweeps;
+
+static struct render batch_template;
+static atomic_uint batch_next;
+
+static float *batch_new_preset(void)
+{
+	batch_presets = realloc(batch_presets, (batch_nr_presets+1) * sizeof(*batch_presets));
+	if (!batch_presets) {
+		perror("realloc");
+		exit(1);
+	}
+	return batch_presets[batch_nr_presets++];
+}
+
+// "pot:from:to:steps"
+static int batch_parse_sweep(const char *arg)
+{
+	char *end;
+
+	if (batch_nr_sweeps == MAX_SWEEPS)
+		return 0;
+	int pot = strtol(arg, &end, 10);
+	if (*end != ':' || pot < 0 || pot >= 4*MAX_CHAIN)
+		return 0;
+	float from = strtof(end+1, &end);
+	if (*end != ':')
+		return 0;
+	float to = strtof(end+1, &end);
+	if (*end != ':')
+		return 0;
+	int steps = strtol(end+1, &end, 10);
+	if (*end || steps < 1)
+		return 0;
+
+	batch_sweeps[batch_nr_sweeps].pot = pot;
+	batch_sweeps[batch_nr_sweeps].from = from;
+	batch_sweeps[batch_nr_sweeps].to = to;
+	batch_sweeps[batch_nr_sweeps].steps = steps;
+	batch_nr_sweeps++;
+	return 1;
+}
+
+//
+// The --preset lists are kept as given until batch_run(),
+// because the default pots may come after them
+//
+static const char *batch_preset_args[256];
+static int batch_nr_preset_args;
+
+// Parse the batch options, returns non-zero if it was one
+static int batch_option(const char *arg)
+{
+	if (!strncmp(arg, "--batch=", 8)) {
+		batch_dir = arg+8;
+		return 1;
+	}
+	if (!strncmp(arg, "--jobs=", 7)) {
+		batch_jobs = atoi(arg+7);
+		return 1;
+	}
+	if (!strncmp(arg, "--preset=", 9)) {
+		if (batch_nr_preset_args == ARRAY_SIZE(batch_preset_args)) {
+			fprintf(stderr, "Too many presets\n");
+			exit(1);
+		}
+		batch_preset_args[batch_nr_preset_args++] = arg+9;
+		return 1;
+	}
+	if (!strncmp(arg, "--sweep=", 8)) {
+		if (batch_parse_sweep(arg+8))
+			return 1;
+		fprintf(stderr, "Bad sweep '%s'\n", arg+8);
+		exit(1);
+	}
+	return 0;
+}
+
+//
+// Regular files get mapped, anything else (a pipe from ffmpeg)
+// gets read into memory in full
+//
+static void batch_add_input(const char *name)
+{
+	struct batch_input *in;
+	struct stat st;
+	int fd = 0;
+
+	if (strcmp(name, "-")) {
+		fd = open(name, O_RDONLY);
+		if (fd < 0) {
+			perror(name);
+			exit(1);
+		}
+	}
+
+	batch_inputs = realloc(batch_inputs, (batch_nr_inputs+1) * sizeof(*batch_inputs));
+	if (!batch_inputs) {
+		perror("realloc");
+		exit(1);
+	}
+	in = batch_inputs + batch_nr_inputs++;
+	in->name = name;
+
+	if (!fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size >= 4) {
+		size_t size = st.st_size & ~3;
+		void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map != MAP_FAILED) {
+			close(fd);
+			in->data = map;
+			in->samples = size / 4;
+			return;
+		}
+	}
+
+	size_t size = 0, alloc = 0;
+	char *buf = NULL;
+	for (;;) {
+		if (size == alloc) {
+			alloc = alloc ? 2*alloc : 1 << 20;
+			buf = realloc(buf, alloc);
+			if (!buf) {
+				perror("realloc");
+				exit(1);
+			}
+		}
+		ssize_t n = read(fd, buf + size, alloc - size);
+		if (n < 0) {
+			perror(name);
+			exit(1);
+		}
+		if (!n)
+			break;
+		size += n;
+	}
+	if (fd)
+		close(fd);
+	in->data = (const s32 *) buf;
+	in->samples = size / 4;
+}
+
+// All the presets and sweeps, from the pots in 'base'
+static void batch_make_presets(const struct render *base)
+{
+	int nr_pots = 4*base->chain_len;
+
+	// Without any --preset, just the one from the base pots
+	int nr = batch_nr_preset_args ? batch_nr_preset_args : 1;
+
+	for (int i = 0; i < nr; i++) {
+		float *pots = batch_new_preset();
+
+		for (int j = 0; j < nr_pots; j++)
+			pots[j] = base->chain[j/4].pots[j%4];
+		if (!batch_nr_preset_args)
+			continue;
+
+		const char *arg = batch_preset_args[i];
+		for (int j = 0; *arg; j++) {
+			char *end;
+			float val = strtof(arg, &end);
+
+			if (end == arg || j == nr_pots || (*end && *end != ',')) {
+				fprintf(stderr, "Bad preset '%s'\n", batch_preset_args[i]);
+				exit(1);
+			}
+			pots[j] = val;
+			arg = *end ? end+1 : end;
+		}
+	}
+
+	for (int s = 0; s < batch_nr_sweeps; s++) {
+		int pot = batch_sweeps[s].pot, steps = batch_sweeps[s].steps;
+		float from = batch_sweeps[s].from, to = batch_sweeps[s].to;
+		int old = batch_nr_presets;
+
+		if (pot >= nr_pots) {
+			fprintf(stderr, "Sweep of pot %d, but the chain has %d\n", pot, nr_pots);
+			exit(1);
+		}
+
+		// Every existing preset gets the first value, and
+		// new copies of it get the rest
+		for (int i = 0; i < old; i++) {
+			for (int step = 1; step < steps; step++) {
+				float *pots = batch_new_preset();
+
+				memcpy(pots, batch_presets[i], sizeof(batch_presets[i]));
+				pots[pot] = from + (to - from) * step / (steps - 1);
+			}
+			batch_presets[i][pot] = from;
+		}
+	}
+}
+
+// The input name without the directories or the .raw, in 'len' bytes
+static const char *batch_input_base(const struct batch_input *in, int *len)
+{
+	const char *base = strrchr(in->name, '/');
+	base = base ? base+1 : in->name;
+	if (!strcmp(base, "-"))
+		base = "stdin";
+
+	int baselen = strlen(base);
+	if (baselen > 4 && !strcmp(base + baselen - 4, ".raw"))
+		baselen -= 4;
+	*len = baselen;
+	return base;
+}
+
+// Two inputs with the same base name would render to the same files
+static void batch_check_names(void)
+{
+	for (int i = 0; i < batch_nr_inputs; i++) {
+		int len, other;
+		const char *base = batch_input_base(batch_inputs + i, &len);
+
+		for (int j = 0; j < i; j++) {
+			const char *prev = batch_input_base(batch_inputs + j, &other);
+
+			if (len == other && !memcmp(base, prev, len)) {
+				fprintf(stderr, "'%s' and '%s' would both render to %s/%.*s-<n>.raw\n",
+					batch_inputs[j].name, batch_inputs[i].name, batch_dir, len, base);
+				exit(1);
+			}
+		}
+	}
+}
+
+// "dir/name-3.raw"
+static void batch_output_name(char *buf, size_t len, int task)
+{
+	int baselen;
+	const char *base = batch_input_base(batch_inputs + task / batch_nr_presets, &baselen);
+
+	snprintf(buf, len, "%s/%.*s-%d.raw", batch_dir, baselen, base, task % batch_nr_presets);
+}
+
+static void batch_render(int task)
+{
+	const struct batch_input *in = batch_inputs + task / batch_nr_presets;
+	const float *pots = batch_presets[task % batch_nr_presets];
+	size_t size = in->samples * 4;
+	struct render *r;
+	char name[4096];
+
+	r = calloc(1, sizeof(*r));
+	if (!r) {
+		perror("calloc");
+		exit(1);
+	}
+	r->chain_len = batch_template.chain_len;
+	r->channels = batch_template.channels;
+	r->spread = batch_template.spread;
+	for (int i = 0; i < r->chain_len; i++) {
+		r->chain[i].eff = batch_template.chain[i].eff;
+		memcpy(r->chain[i].pots, pots + 4*i, sizeof(r->chain[i].pots));
+	}
+	render_setup(r);
+
+	batch_output_name(name, sizeof(name), task);
+	int fd = open(name, O_CREAT | O_RDWR | O_TRUNC, 0666);
+	if (fd < 0) {
+		perror(name);
+		exit(1);
+	}
+	if (size) {
+		s32 *dst = map_output(fd, size);
+		if (!dst) {
+			perror(name);
+			exit(1);
+		}
+		render_buffer(r, in->data, dst, in->samples);
+		munmap(dst, size);
+	}
+	close(fd);
+
+	render_free(r);
+	free(r);
+}
+
+static void *batch_worker(void *arg)
+{
+	unsigned int tasks = batch_nr_inputs * batch_nr_presets;
+
+	// The static arena is the main thread's, this one mallocs it all
+	delay_arena_use(NULL, 0);
+	denormals_off();
+
+	for (;;) {
+		unsigned int task = atomic_fetch_add(&batch_next, 1);
+		if (task >= tasks)
+			break;
+		batch_render(task);
+		delay_arena_reset();
+	}
+	return NULL;
+}
+
+static void batch_write_index(void)
+{
+	char name[4096];
+
+	snprintf(name, sizeof(name), "%s/index.txt", batch_dir);
+	FILE *f = fopen(name, "w");
+	if (!f) {
+		perror(name);
+		exit(1);
+	}
+	for (int task = 0; task < batch_nr_inputs * batch_nr_presets; task++) {
+		const float *pots = batch_presets[task % batch_nr_presets];
+
+		batch_output_name(name, sizeof(name), task);
+		fprintf(f, "%s\t%s", strrchr(name, '/') + 1, batch_inputs[task / batch_nr_presets].name);
+		for (int j = 0; j < 4*batch_template.chain_len; j++)
+			fprintf(f, "\t%g", pots[j]);
+		fprintf(f, "\n");
+	}
+	fclose(f);
+}
+
+static int batch_run(struct render *base)
+{
+	struct timespec start, end;
+
+	if (!batch_nr_inputs) {
+		fprintf(stderr, "No batch inputs\n");
+		exit(1);
+	}
+	batch_check_names();
+	if (mkdir(batch_dir, 0777) && errno != EEXIST) {
+		perror(batch_dir);
+		exit(1);
+	}
+
+	batch_template = *base;
+	batch_make_presets(base);
+	batch_write_index();
+
+	int tasks = batch_nr_inputs * batch_nr_presets;
+	int jobs = batch_jobs > 0 ? batch_jobs : sysconf(_SC_NPROCESSORS_ONLN);
+	if (jobs > tasks)
+		jobs = tasks;
+	if (jobs < 1)
+		jobs = 1;
+
+	fprintf(stderr, "Rendering %d input(s) x %d preset(s) of ", batch_nr_inputs, batch_nr_presets);
+	describe_chain(base);
+
+	pthread_t threads[jobs];
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < jobs; i++) {
+		if (pthread_create(threads+i, NULL, batch_worker, NULL)) {
+			fprintf(stderr, "Can't create worker thread\n");
+			exit(1);
+		}
+	}
+	for (int i = 0; i < jobs; i++)
+		pthread_join(threads[i], NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	fprintf(stderr, "%d renders on %d thread(s) in %.2f s\n", tasks, jobs,
+		(end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9);
+	return 0;
+}
@@ -0,0 +1,313 @@
+//
+// Measure how expensive each effect is
+//
+//	benchmark [--header] [--denormals] [effect [pot pot pot pot]]
+//	benchmark [--header] --sine
+//
+// runs the effect (or every effect, with all pots at 0.5) over a few
+// seconds of each of the synthetic test signals, the same way convert
+// does: BLOCKSIZE samples at a time, with init before every block.
+//
+// The output is one tab-separated line per effect and signal, and
+// with --header (or when doing every effect) a '#' header line first:
+//
+//	effect pots signal ns/sample samples/sec cycles/sample %realtime
+//
+// where %realtime is how much of the 48kHz per-sample budget that is.
+//
+// Like convert, it runs with denormals flushed to zero. Comparing the
+// 'tail' signal (a short burst of noise and then a long decay) with
+// and without --denormals shows what that saves.
+// The cycles are TSC cycles on x86, which tick at a fixed rate that
+// isn't necessarily the core clock, and just ns times a nominal 1GHz
+// elsewhere.
+//
+// --sine is about the quarter sine table it was built with (see
+// sintable.h): its size, the max error and ns per value of the LFO
+// sinewave and fastsincos() over a million phases, and the effects
+// that lean on them. 'make bench-sine' builds and runs one of these
+// for each table size:
+//
+//	steps lookup bytes lfo-error lfo-ns sincos-error sincos-ns flanger-ns fm-ns phaser-ns
+//
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <math.h>
+
+#include "effects.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define cycles() __rdtsc()
+#else
+#define cycles() 0
+#endif
+
+#define BLOCKSIZE 200
+#define BENCH_SAMPLES (10 * 48000)
+#define BENCH_RUNS 3
+
+static float signal[BENCH_SAMPLES], output[BENCH_SAMPLES];
+
+enum bench_signal {
+	bench_tone,
+	bench_silence,
+	bench_noise,
+	bench_impulse,
+	bench_tail,
+};
+
+static const char *signal_names[] = {
+	[bench_tone] = "tone",
+	[bench_silence] = "silence",
+	[bench_noise] = "noise",
+	[bench_impulse] = "impulse",
+	[bench_tail] = "tail",
+};
+
+static void make_signal(enum bench_signal type)
+{
+	srand(1);
+	for (int i = 0; i < BENCH_SAMPLES; i++) {
+		float val = 0;
+
+		switch (type) {
+		case bench_tone:
+			val = 0.5f * sinf(2 * (float) M_PI * 110 * i / SAMPLES_PER_SEC);
+			break;
+		case bench_silence:
+			break;
+		case bench_noise:
+			val = (rand() & 0xffff) / 65536.0f - 0.5f;
+			break;
+		case bench_impulse:
+			// One every half second, and then let the tail ring
+			val = (i % 24000) ? 0 : 0.9f;
+			break;
+		case bench_tail:
+			// A tenth of a second of noise, then nothing
+			if (i < 4800)
+				val = (rand() & 0xffff) / 65536.0f - 0.5f;
+			break;
+		}
+		signal[i] = val;
+	}
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	// Single-precision constants, so keep the seconds out of float
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double) ts.tv_sec + (double) ts.tv_nsec / 1000000000;
+}
+
+static void render(const struct effect *eff, void *state, float pot[4])
+{
+	for (int pos = 0; pos < BENCH_SAMPLES; pos += BLOCKSIZE) {
+		const float *in = signal + pos;
+		float *out = output + pos;
+
+		eff->init(state, pot);
+		if (eff->block) {
+			eff->block(state, in, out, BLOCKSIZE);
+		} else {
+			for (int i = 0; i < BLOCKSIZE; i++)
+				out[i] = eff->step(state, in[i]);
+		}
+	}
+}
+
+// Best of a few runs, after one to warm up the caches and state.
+// Returns the ns per sample, and the cycles in 'cyc'
+static double bench_run(const struct effect *eff, float pot[4], enum bench_signal type, double *cyc)
+{
+	void *state = calloc(1, eff->size ? eff->size : 1);
+	double best = 1e9;
+	unsigned long long best_cycles = 0;
+
+	if (!state) {
+		perror("calloc");
+		exit(1);
+	}
+
+	make_signal(type);
+	render(eff, state, pot);
+
+	for (int run = 0; run < BENCH_RUNS; run++) {
+		unsigned long long c = cycles();
+		double t = now();
+
+		render(eff, state, pot);
+
+		t = now() - t;
+		c = cycles() - c;
+		if (t < best) {
+			best = t;
+			best_cycles = c;
+		}
+	}
+	effect_free(eff, state);
+	delay_arena_reset();
+
+	double ns = best * 1e9 / BENCH_SAMPLES;
+	*cyc = best_cycles ? (double) best_cycles / BENCH_SAMPLES : ns;
+	return ns;
+}
+
+static void bench(const struct effect *eff, float pot[4], enum bench_signal type)
+{
+	double cyc, ns = bench_run(eff, pot, type, &cyc);
+
+	printf("%s\t%g,%g,%g,%g\t%s\t%.2f\t%.0f\t%.1f\t%.3f\n",
+		eff->name, pot[0], pot[1], pot[2], pot[3],
+		signal_names[type], ns, 1e9 / ns, cyc,
+		100 * ns / (1e9 / SAMPLES_PER_SEC));
+}
+
+static void bench_effect(const struct effect *eff, float pot[4])
+{
+	for (int i = 0; i < ARRAY_SIZE(signal_names); i++)
+		bench(eff, pot, i);
+	fflush(stdout);
+}
+
+static void header(void)
+{
+	printf("# effect\tpots\tsignal\tns/sample\tsamples/sec\tcycles/sample\t%%realtime\n");
+}
+
+#define SINE_POINTS (1 << 20)
+#define SINE_RUNS 20
+
+static u32 sine_phase[SINE_POINTS];
+static float sine_out[SINE_POINTS];
+
+#ifdef QUARTER_SINE_NEAREST
+#define SINE_LOOKUP "nearest"
+#else
+#define SINE_LOOKUP "linear"
+#endif
+
+static void sine_header(void)
+{
+	printf("# steps\tlookup\tbytes\tlfo-error\tlfo-ns\tsincos-error\tsincos-ns\tflanger-ns\tfm-ns\tphaser-ns\n");
+}
+
+static double sine_time(int lfo)
+{
+	double best = 1e9;
+
+	for (int run = 0; run < SINE_RUNS; run++) {
+		struct lfo_state s = { .idx = 12345, .step = 0x9e3779b9 };
+		double t = now();
+
+		if (lfo) {
+			lfo_sinewave_fill(&s, sine_out, SINE_POINTS);
+		} else {
+			for (int i = 0; i < SINE_POINTS; i++) {
+				struct sincos sc = fastsincos(u32_to_fraction(sine_phase[i] & 0xffffff00));
+				sine_out[i] = sc.sin + sc.cos;
+			}
+		}
+		t = now() - t;
+		if (t < best)
+			best = t;
+	}
+	return best * 1e9 / SINE_POINTS;
+}
+
+// The phases step by the golden ratio, so they're all over the cycle
+// and land anywhere between the table entries
+static void bench_sine(void)
+{
+	double two_pi = 8 * atan(1), lfo_err = 0, sincos_err = 0, cyc;
+	struct lfo_state s = { .idx = 12345, .step = 0x9e3779b9 };
+	float pot[4] = { 0.5, 0.5, 0.5, 0.5 };
+
+	lfo_sinewave_fill(&s, sine_out, SINE_POINTS);
+	for (int i = 0; i < SINE_POINTS; i++) {
+		u32 idx = 12345 + i * 0x9e3779b9;
+
+		// Full precision of the float phases for fastsincos
+		u32 phase = idx & 0xffffff00;
+		struct sincos sc = fastsincos(u32_to_fraction(phase));
+		double x = two_pi * ((double) phase * 0x1p-32);
+
+		sine_phase[i] = idx;
+		lfo_err = fmax(lfo_err, fabs(sine_out[i] - sin(two_pi * ((double) idx * 0x1p-32))));
+		sincos_err = fmax(sincos_err, fabs(sc.sin - sin(x)));
+		sincos_err = fmax(sincos_err, fabs(sc.cos - cos(x)));
+	}
+
+	double lfo_ns = sine_time(1);
+	double sincos_ns = sine_time(0);
+
+	printf("%d\t%s\t%zu\t%.3g\t%.2f\t%.3g\t%.2f\t%.2f\t%.2f\t%.2f\n",
+		QUARTER_SINE_STEPS, SINE_LOOKUP, sizeof(quarter_sin),
+		lfo_err, lfo_ns, sincos_err, sincos_ns,
+		bench_run(&flanger_effect, pot, bench_tone, &cyc),
+		bench_run(&fm_effect, pot, bench_tone, &cyc),
+		bench_run(&phaser_effect, pot, bench_tone, &cyc));
+}
+
+int main(int argc, char **argv)
+{
+	float pot[4] = { 0.5, 0.5, 0.5, 0.5 };
+
+	fir_select();
+
+	if (argc > 1 && !strcmp(argv[1], "--header")) {
+		if (argc > 2 && !strcmp(argv[2], "--sine"))
+			sine_header();
+		else
+			header();
+		if (argc == 2)
+			return 0;
+		argv++;
+		argc--;
+	}
+	if (argc == 2 && !strcmp(argv[1], "--sine")) {
+		denormals_off();
+		bench_sine();
+		return 0;
+	}
+	if (argc > 1 && !strcmp(argv[1], "--denormals")) {
+		argv++;
+		argc--;
+	} else {
+		denormals_off();
+	}
+	if (argc > 6) {
+		fprintf(stderr, "usage: benchmark [--header] [--denormals] [effect [pot pot pot pot]]\n"
+			"       benchmark [--header] --sine\n");
+		exit(1);
+	}
+	for (int i = 2; i < argc; i++)
+		pot[i-2] = strtof(argv[i], NULL);
+
+	if (argc > 1) {
+		const struct effect *eff = find_effect(argv[1], strlen(argv[1]));
+		if (!eff) {
+			fprintf(stderr, "Unknown effect '%s'\n", argv[1]);
+			exit(1);
+		}
+		bench_effect(eff, pot);
+		return 0;
+	}
+
+	header();
+	for (int i = 0; i < ARRAY_SIZE(effects); i++)
+		bench_effect(effects[i], pot);
+	return 0;
+}
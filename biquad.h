@@ -10,16 +10,33 @@ struct biquad_state {
 	float x[2], y[2];
 };
 
+//
+// Fixed-point biquads
+//
+// The coefficients are Q2.30, since a1 goes up to +-2. The samples
+// can be in any fixed-point format with enough headroom for the
+// filter gain, and the output is in the same format as the input.
+// The accumulator is 64 bits, so only the final result gets rounded.
+//
+struct biquad_q30 {
+	s32 b0, b1, b2;
+	s32 a1, a2;
+};
+
 struct biquad {
 	struct biquad_coeff coeff;
 	struct biquad_state state;
+#ifdef FIXED_POINT
+	struct biquad_q30 q30;
+	s32 x[2], y[2];
+#endif
 };
 
 // Direct form 1 may need more state than the "canonical" DF2,
 // but gets noisy much quicker.
 static inline float biquad_step_df1(struct biquad_coeff *c, float in, float x[2], float y[2])
 {
-	float out = c->b0*in + c->b1*x[0] + c->b2*x[1] - c->a1*y[0] - c->a2*y[1];
+	float out = flush_denormal(c->b0*in + c->b1*x[0] + c->b2*x[1] - c->a1*y[0] - c->a2*y[1]);
 	x[1] = x[0]; x[0] = in;
 	y[1] = y[0]; y[0] = out;
 	return out;
@@ -30,9 +47,34 @@ static inline float _biquad_step(struct biquad_coeff *c, struct biquad_state *s,
 	return biquad_step_df1(c, x0, s->x, s->y);
 }
 
+static inline s32 float_to_q30(float x)
+{
+	return (s32) (x * 1073741824.0f);
+}
+
+static inline void biquad_q30_set(struct biquad_q30 *q, const struct biquad_coeff *c)
+{
+	q->b0 = float_to_q30(c->b0);
+	q->b1 = float_to_q30(c->b1);
+	q->b2 = float_to_q30(c->b2);
+	q->a1 = float_to_q30(c->a1);
+	q->a2 = float_to_q30(c->a2);
+}
+
+static inline s32 biquad_q30_step_df1(const struct biquad_q30 *c, s32 in, s32 x[2], s32 y[2])
+{
+	s64 acc = (s64) c->b0*in + (s64) c->b1*x[0] + (s64) c->b2*x[1]
+		- (s64) c->a1*y[0] - (s64) c->a2*y[1];
+	s32 out = q31_sat((acc + (1 << 29)) >> 30);
+
+	x[1] = x[0]; x[0] = in;
+	y[1] = y[0]; y[0] = out;
+	return out;
+}
+
 static inline void _biquad_lpf(struct biquad_coeff *res, float f, float Q)
 {
-	struct sincos w0 = fastsincos(f/SAMPLES_PER_SEC);
+	struct sincos w0 = fastsincos(f*SAMPLE_PERIOD);
 	float alpha = w0.sin/(2*Q);
 	float a0_inv = 1/(1 + alpha);
 	float b1 = (1 - w0.cos) * a0_inv;
@@ -46,7 +88,7 @@ static inline void _biquad_lpf(struct biquad_coeff *res, float f, float Q)
 
 static inline void _biquad_hpf(struct biquad_coeff *res, float f, float Q)
 {
-	struct sincos w0 = fastsincos(f/SAMPLES_PER_SEC);
+	struct sincos w0 = fastsincos(f*SAMPLE_PERIOD);
 	float alpha = w0.sin/(2*Q);
 	float a0_inv = 1/(1 + alpha);
 	float b1 = (1 + w0.cos) * a0_inv;
@@ -60,7 +102,7 @@ static inline void _biquad_hpf(struct biquad_coeff *res, float f, float Q)
 
 static inline void _biquad_notch_filter(struct biquad_coeff *res, float f, float Q)
 {
-	struct sincos w0 = fastsincos(f/SAMPLES_PER_SEC);
+	struct sincos w0 = fastsincos(f*SAMPLE_PERIOD);
 	float alpha = w0.sin/(2*Q);
 	float a0_inv = 1/(1 + alpha);
 
@@ -73,7 +115,7 @@ static inline void _biquad_notch_filter(struct biquad_coeff *res, float f, float
 
 static inline void _biquad_bpf_peak(struct biquad_coeff *res, float f, float Q)
 {
-	struct sincos w0 = fastsincos(f/SAMPLES_PER_SEC);
+	struct sincos w0 = fastsincos(f*SAMPLE_PERIOD);
 	float alpha = w0.sin/(2*Q);
 	float a0_inv = 1/(1 + alpha);
 
@@ -86,7 +128,7 @@ static inline void _biquad_bpf_peak(struct biquad_coeff *res, float f, float Q)
 
 static inline void _biquad_bpf(struct biquad_coeff *res, float f, float Q)
 {
-	struct sincos w0 = fastsincos(f/SAMPLES_PER_SEC);
+	struct sincos w0 = fastsincos(f*SAMPLE_PERIOD);
 	float alpha = w0.sin/(2*Q);
 	float a0_inv = 1/(1 + alpha);
 
@@ -99,7 +141,7 @@ static inline void _biquad_bpf(struct biquad_coeff *res, float f, float Q)
 
 static inline void _biquad_allpass_filter(struct biquad_coeff *res, float f, float Q)
 {
-	struct sincos w0 = fastsincos(f/SAMPLES_PER_SEC);
+	struct sincos w0 = fastsincos(f*SAMPLE_PERIOD);
 	float alpha = w0.sin/(2*Q);
 	float a0_inv = 1/(1 + alpha);
 
@@ -110,12 +152,511 @@ static inline void _biquad_allpass_filter(struct biquad_coeff *res, float f, flo
 	res->a2 = res->b0;
 }
 
+//
+// Parametric EQ sections (the "Audio EQ Cookbook" ones), with
+// 'gain' the linear amplitude gain at (peak) or beyond (shelves)
+// 'f'. A gain of 1 is a no-op filter.
+//
+// In the fixed-point build keep the coefficients within the
+// Q2.30 range, ie no more than about 6dB of boost.
+//
+static inline void _biquad_peak_eq(struct biquad_coeff *res, float f, float Q, float gain)
+{
+	struct sincos w0 = fastsincos(f*SAMPLE_PERIOD);
+	float A = sqrtf(gain);
+	float alpha = w0.sin/(2*Q);
+	float a0_inv = 1/(1 + alpha/A);
+
+	res->b0 = (1 + alpha*A)	* a0_inv;
+	res->b1 = -2*w0.cos	* a0_inv;
+	res->b2 = (1 - alpha*A)	* a0_inv;
+	res->a1 = res->b1;
+	res->a2 = (1 - alpha/A)	* a0_inv;
+}
+
+static inline void _biquad_low_shelf(struct biquad_coeff *res, float f, float Q, float gain)
+{
+	struct sincos w0 = fastsincos(f*SAMPLE_PERIOD);
+	float A = sqrtf(gain);
+	float beta = sqrtf(A) * w0.sin/Q;	// 2*sqrt(A)*alpha
+	float am1 = (A-1)*w0.cos, ap1 = (A+1)*w0.cos;
+	float a0_inv = 1/((A+1) + am1 + beta);
+
+	res->b0 = A*((A+1) - am1 + beta)	* a0_inv;
+	res->b1 = 2*A*((A-1) - ap1)		* a0_inv;
+	res->b2 = A*((A+1) - am1 - beta)	* a0_inv;
+	res->a1 = -2*((A-1) + ap1)		* a0_inv;
+	res->a2 = ((A+1) + am1 - beta)		* a0_inv;
+}
+
+static inline void _biquad_high_shelf(struct biquad_coeff *res, float f, float Q, float gain)
+{
+	struct sincos w0 = fastsincos(f*SAMPLE_PERIOD);
+	float A = sqrtf(gain);
+	float beta = sqrtf(A) * w0.sin/Q;
+	float am1 = (A-1)*w0.cos, ap1 = (A+1)*w0.cos;
+	float a0_inv = 1/((A+1) - am1 + beta);
+
+	res->b0 = A*((A+1) + am1 + beta)	* a0_inv;
+	res->b1 = -2*A*((A-1) + ap1)		* a0_inv;
+	res->b2 = A*((A+1) + am1 - beta)	* a0_inv;
+	res->a1 = 2*((A-1) - ap1)		* a0_inv;
+	res->a2 = ((A+1) - am1 - beta)		* a0_inv;
+}
+
+//
+// In the fixed-point build 'struct biquad' filters run on the
+// Q2.30 coefficients, with the float samples converted to Q2.29
+// (so there is FIXED_HEADROOM for gain above full scale).
+//
 static inline float biquad_step(struct biquad *bq, float x0)
-{ return _biquad_step(&bq->coeff, &bq->state, x0); }
-
-#define biquad_lpf(bq,f,Q) _biquad_lpf(&(bq)->coeff,f,Q)
-#define biquad_hpf(bq,f,Q) _biquad_hpf(&(bq)->coeff,f,Q)
-#define biquad_notch_filter(bq,f,Q) _biquad_notch_filter(&(bq)->coeff,f,Q)
-#define biquad_bpf_peak(bq,f,Q) _biquad_bpf_peak(&(bq)->coeff,f,Q)
-#define biquad_bpf(bq,f,Q) _biquad_bpf(&(bq)->coeff,f,Q)
-#define biquad_allpass_filter(bq,f,Q) _biquad_allpass_filter(&(bq)->coeff,f,Q)
+{
+#ifdef FIXED_POINT
+	s32 in = float_to_q31(x0 * (1.0f / (1 << FIXED_HEADROOM)));
+	s32 out = biquad_q30_step_df1(&bq->q30, in, bq->x, bq->y);
+	return q31_to_float(out) * (1 << FIXED_HEADROOM);
+#else
+	return _biquad_step(&bq->coeff, &bq->state, x0);
+#endif
+}
+
+static inline void _biquad_set(struct biquad *bq,
+	void (*design)(struct biquad_coeff *, float, float), float f, float Q)
+{
+	design(&bq->coeff, f, Q);
+#ifdef FIXED_POINT
+	biquad_q30_set(&bq->q30, &bq->coeff);
+#endif
+}
+
+#define biquad_lpf(bq,f,Q) _biquad_set(bq,_biquad_lpf,f,Q)
+#define biquad_hpf(bq,f,Q) _biquad_set(bq,_biquad_hpf,f,Q)
+#define biquad_notch_filter(bq,f,Q) _biquad_set(bq,_biquad_notch_filter,f,Q)
+#define biquad_bpf_peak(bq,f,Q) _biquad_set(bq,_biquad_bpf_peak,f,Q)
+#define biquad_bpf(bq,f,Q) _biquad_set(bq,_biquad_bpf,f,Q)
+#define biquad_allpass_filter(bq,f,Q) _biquad_set(bq,_biquad_allpass_filter,f,Q)
+
+//
+// Swept filters at control rate
+//
+// Working out the coefficients is often more expensive than the
+// filter itself, so for a filter that is swept by an LFO we only do
+// it every 'interval' samples ("control rate"), and either hold the
+// coefficients or linearly interpolate them in between.
+//
+// Usage per sample:
+//
+//	if (biquad_sweep_due(&sweep)) {
+//		.. work out 'target' for 'interval' samples from now ..
+//		biquad_sweep_target(&sweep, &target);
+//	}
+//	c = biquad_sweep_step(&sweep);
+//
+// An interval of 1 gives you the exact per-sample coefficients.
+//
+struct biquad_sweep {
+	struct biquad_coeff coeff, delta, target;
+	int interval, count;
+	int hold, primed;
+};
+
+static inline void biquad_sweep_init(struct biquad_sweep *s, int interval, int hold)
+{
+	s->interval = interval > 0 ? interval : 1;
+	s->hold = hold;
+	s->count = 0;
+}
+
+static inline int biquad_sweep_due(struct biquad_sweep *s)
+{
+	return !s->count;
+}
+
+static inline void biquad_sweep_target(struct biquad_sweep *s, const struct biquad_coeff *target)
+{
+	float n = s->interval;
+
+	// Start the ramp from exactly where the last one was supposed
+	// to end up, so rounding errors don't accumulate
+	if (s->hold || !s->primed) {
+		s->coeff = *target;
+		s->delta = (struct biquad_coeff) { 0 };
+		s->primed = 1;
+	} else {
+		s->coeff = s->target;
+		s->delta.b0 = (target->b0 - s->coeff.b0) / n;
+		s->delta.b1 = (target->b1 - s->coeff.b1) / n;
+		s->delta.b2 = (target->b2 - s->coeff.b2) / n;
+		s->delta.a1 = (target->a1 - s->coeff.a1) / n;
+		s->delta.a2 = (target->a2 - s->coeff.a2) / n;
+	}
+	s->target = *target;
+	s->count = s->interval;
+}
+
+static inline struct biquad_coeff *biquad_sweep_step(struct biquad_sweep *s)
+{
+	s->count--;
+	s->coeff.b0 += s->delta.b0;
+	s->coeff.b1 += s->delta.b1;
+	s->coeff.b2 += s->delta.b2;
+	s->coeff.a1 += s->delta.a1;
+	s->coeff.a2 += s->delta.a2;
+	return &s->coeff;
+}
+
+//
+// The fixed-point version of biquad_sweep_step(): q[0] is the
+// current Q2.30 coefficients and q[1] the per-sample delta. Call
+// biquad_q30_sweep_start() after every biquad_sweep_target().
+//
+static inline void biquad_q30_sweep_start(const struct biquad_sweep *s, struct biquad_q30 q[2])
+{
+	biquad_q30_set(q+0, &s->coeff);
+	biquad_q30_set(q+1, &s->delta);
+}
+
+static inline struct biquad_q30 *biquad_q30_sweep_step(struct biquad_sweep *s, struct biquad_q30 q[2])
+{
+	s->count--;
+	q[0].b0 += q[1].b0;
+	q[0].b1 += q[1].b1;
+	q[0].b2 += q[1].b2;
+	q[0].a1 += q[1].a1;
+	q[0].a2 += q[1].a2;
+	return q;
+}
+
+//
+// Lane-parallel biquads
+//
+// BIQUAD_LANES filters - typically one per channel - each with its
+// own coefficients and state, but stepped together. Everything is
+// stored lane by lane, so that each line of the filter math is one
+// loop over the lanes that the compiler turns into a vector operation.
+// Unused lanes just filter zeroes.
+//
+// Swept lanes work like biquad_sweep_step(), except the interpolation
+// is done lane-wise too: load a lane from its biquad_sweep after every
+// biquad_sweep_target(), and advance all of them once per sample.
+//
+#define BIQUAD_LANES 4
+
+struct biquad_lane_coeff {
+	float b0[BIQUAD_LANES], b1[BIQUAD_LANES], b2[BIQUAD_LANES];
+	float a1[BIQUAD_LANES], a2[BIQUAD_LANES];
+};
+
+struct biquad_lanes {
+	struct biquad_lane_coeff coeff, delta;
+};
+
+static inline void biquad_lane_set(struct biquad_lane_coeff *l, int lane, const struct biquad_coeff *c)
+{
+	l->b0[lane] = c->b0;
+	l->b1[lane] = c->b1;
+	l->b2[lane] = c->b2;
+	l->a1[lane] = c->a1;
+	l->a2[lane] = c->a2;
+}
+
+static inline void biquad_lane_get(const struct biquad_lane_coeff *l, int lane, struct biquad_coeff *c)
+{
+	c->b0 = l->b0[lane];
+	c->b1 = l->b1[lane];
+	c->b2 = l->b2[lane];
+	c->a1 = l->a1[lane];
+	c->a2 = l->a2[lane];
+}
+
+static inline void biquad_lanes_load(struct biquad_lanes *l, int lane, const struct biquad_sweep *s)
+{
+	biquad_lane_set(&l->coeff, lane, &s->coeff);
+	biquad_lane_set(&l->delta, lane, &s->delta);
+}
+
+static inline void biquad_lanes_advance(struct biquad_lanes *l)
+{
+	for (int i = 0; i < BIQUAD_LANES; i++) {
+		l->coeff.b0[i] += l->delta.b0[i];
+		l->coeff.b1[i] += l->delta.b1[i];
+		l->coeff.b2[i] += l->delta.b2[i];
+		l->coeff.a1[i] += l->delta.a1[i];
+		l->coeff.a2[i] += l->delta.a2[i];
+	}
+}
+
+// One sample of lanes 'lo' to 'hi'-1, in place in 'val'
+static inline __attribute__((always_inline))
+void biquad_lanes_range_df1(const struct biquad_lane_coeff *c, float val[BIQUAD_LANES],
+	float x[2][BIQUAD_LANES], float y[2][BIQUAD_LANES], int lo, int hi)
+{
+	for (int i = lo; i < hi; i++) {
+		float in = val[i];
+		float out = flush_denormal(c->b0[i]*in + c->b1[i]*x[0][i] + c->b2[i]*x[1][i]
+			- c->a1[i]*y[0][i] - c->a2[i]*y[1][i]);
+
+		x[1][i] = x[0][i]; x[0][i] = in;
+		y[1][i] = y[0][i]; y[0][i] = out;
+		val[i] = out;
+	}
+}
+
+// One sample of every lane, in place in 'val'
+static inline void biquad_lanes_step_df1(const struct biquad_lane_coeff *c, float val[BIQUAD_LANES],
+	float x[2][BIQUAD_LANES], float y[2][BIQUAD_LANES])
+{
+	biquad_lanes_range_df1(c, val, x, y, 0, BIQUAD_LANES);
+}
+
+// The same in Q2.30, like biquad_q30_step_df1()
+struct biquad_lane_q30 {
+	s32 b0[BIQUAD_LANES], b1[BIQUAD_LANES], b2[BIQUAD_LANES];
+	s32 a1[BIQUAD_LANES], a2[BIQUAD_LANES];
+};
+
+static inline void biquad_lane_q30_set(struct biquad_lane_q30 *l, int lane, const struct biquad_coeff *c)
+{
+	struct biquad_q30 q;
+
+	biquad_q30_set(&q, c);
+	l->b0[lane] = q.b0;
+	l->b1[lane] = q.b1;
+	l->b2[lane] = q.b2;
+	l->a1[lane] = q.a1;
+	l->a2[lane] = q.a2;
+}
+
+static inline __attribute__((always_inline))
+void biquad_lanes_q30_range_df1(const struct biquad_lane_q30 *c, s32 val[BIQUAD_LANES],
+	s32 x[2][BIQUAD_LANES], s32 y[2][BIQUAD_LANES], int lo, int hi)
+{
+	for (int i = lo; i < hi; i++) {
+		s32 in = val[i];
+		s64 acc = (s64) c->b0[i]*in + (s64) c->b1[i]*x[0][i] + (s64) c->b2[i]*x[1][i]
+			- (s64) c->a1[i]*y[0][i] - (s64) c->a2[i]*y[1][i];
+		s32 out = q31_sat((acc + (1 << 29)) >> 30);
+
+		x[1][i] = x[0][i]; x[0][i] = in;
+		y[1][i] = y[0][i]; y[0][i] = out;
+		val[i] = out;
+	}
+}
+
+//
+// Biquad banks
+//
+// Up to BIQUAD_LANES filters of one channel in the lane layout, for
+// effects that have several filters with fixed (or only occasionally
+// changing) coefficients. A bank can be run either
+//
+//	- in parallel, every filter on its own input, which is a
+//	  single pass over the lanes (biquad_bank_step()), or
+//
+//	- as a cascade, the output of filter 0 going into filter 1
+//	  and so on (biquad_bank_cascade()).
+//
+// A plain cascade can't be done across the lanes, since each filter
+// has to wait for the one before it. So it is time-skewed instead:
+// while filter 0 is on sample 't', filter 'k' is on sample 't-k', and
+// every step of that pipeline is one pass over the lanes again. The
+// pipeline fills and drains within the block, so there is no extra
+// latency, just 'nr'-1 partial steps.
+//
+// Either way it's the same math as separate 'struct biquad' filters,
+// though -ffast-math may round the float version differently. In the
+// fixed-point build the samples stay Q2.29 all through a cascade,
+// instead of going back to float in between.
+//
+// The filters are numbered from 0, and 'nr' is one past the highest
+// one that has been set. Lanes past that filter zeroes (or garbage,
+// in a cascade) that nobody looks at.
+//
+struct biquad_bank {
+	int nr;
+	struct biquad_lane_coeff coeff;
+	float x[2][BIQUAD_LANES], y[2][BIQUAD_LANES];
+#ifdef FIXED_POINT
+	struct biquad_lane_q30 q30;
+	s32 qx[2][BIQUAD_LANES], qy[2][BIQUAD_LANES];
+#endif
+};
+
+static inline void biquad_bank_set(struct biquad_bank *b, int i, const struct biquad_coeff *c)
+{
+	biquad_lane_set(&b->coeff, i, c);
+#ifdef FIXED_POINT
+	biquad_lane_q30_set(&b->q30, i, c);
+#endif
+	if (i >= b->nr)
+		b->nr = i+1;
+}
+
+static inline void _biquad_bank_design(struct biquad_bank *b, int i,
+	void (*design)(struct biquad_coeff *, float, float), float f, float Q)
+{
+	struct biquad_coeff c;
+
+	design(&c, f, Q);
+	biquad_bank_set(b, i, &c);
+}
+
+static inline void biquad_bank_eq(struct biquad_bank *b, int i,
+	void (*design)(struct biquad_coeff *, float, float, float), float f, float Q, float gain)
+{
+	struct biquad_coeff c;
+
+	design(&c, f, Q, gain);
+	biquad_bank_set(b, i, &c);
+}
+
+#define biquad_bank_lpf(b,i,f,Q) _biquad_bank_design(b,i,_biquad_lpf,f,Q)
+#define biquad_bank_hpf(b,i,f,Q) _biquad_bank_design(b,i,_biquad_hpf,f,Q)
+#define biquad_bank_notch_filter(b,i,f,Q) _biquad_bank_design(b,i,_biquad_notch_filter,f,Q)
+#define biquad_bank_bpf_peak(b,i,f,Q) _biquad_bank_design(b,i,_biquad_bpf_peak,f,Q)
+#define biquad_bank_bpf(b,i,f,Q) _biquad_bank_design(b,i,_biquad_bpf,f,Q)
+#define biquad_bank_allpass_filter(b,i,f,Q) _biquad_bank_design(b,i,_biquad_allpass_filter,f,Q)
+#define biquad_bank_peak_eq(b,i,f,Q,gain) biquad_bank_eq(b,i,_biquad_peak_eq,f,Q,gain)
+#define biquad_bank_low_shelf(b,i,f,Q,gain) biquad_bank_eq(b,i,_biquad_low_shelf,f,Q,gain)
+#define biquad_bank_high_shelf(b,i,f,Q,gain) biquad_bank_eq(b,i,_biquad_high_shelf,f,Q,gain)
+
+// Every filter of the bank on its own sample, in place in 'val'
+static inline void biquad_bank_step(struct biquad_bank *b, float val[BIQUAD_LANES])
+{
+#ifdef FIXED_POINT
+	s32 q[BIQUAD_LANES];
+
+	for (int i = 0; i < BIQUAD_LANES; i++)
+		q[i] = float_to_q31(val[i] * (1.0f / (1 << FIXED_HEADROOM)));
+	biquad_lanes_q30_range_df1(&b->q30, q, b->qx, b->qy, 0, BIQUAD_LANES);
+	for (int i = 0; i < BIQUAD_LANES; i++)
+		val[i] = q31_to_float(q[i]) * (1 << FIXED_HEADROOM);
+#else
+	// A local copy, which can't be the bank itself
+	float v[BIQUAD_LANES];
+
+	memcpy(v, val, sizeof(v));
+	biquad_lanes_range_df1(&b->coeff, v, b->x, b->y, 0, BIQUAD_LANES);
+	memcpy(val, v, sizeof(v));
+#endif
+}
+
+//
+// The time-skewed cascade. 'v[k]' is the input of filter 'k', and
+// after a step its output, which then moves up a lane to be the
+// input of the next filter. So filter 'k' is busy with the block
+// from step 'k' to step 'n'-1+'k', and 'buf' gets written 'last'
+// steps behind where it is read.
+//
+// The coefficients and the state are copied into locals for the
+// block, as otherwise every store to 'buf' could change them.
+//
+#define BIQUAD_BANK_SKEW(range, load, store)				\
+do {									\
+	for (int k = BIQUAD_LANES-1; k > 0; k--)			\
+		v[k] = v[k-1];						\
+	if (t < n)							\
+		v[0] = load(buf[t]);					\
+	range(&c, v, x, y, t < n ? 0 : t-n+1, t < last ? t+1 : last+1);	\
+	if (t >= last)							\
+		buf[t-last] = store(v[last]);				\
+} while (0)
+
+#ifdef FIXED_POINT
+
+#define biquad_bank_load(x) float_to_q31((x) * (1.0f / (1 << FIXED_HEADROOM)))
+#define biquad_bank_store(x) (q31_to_float(x) * (1 << FIXED_HEADROOM))
+
+static inline void biquad_bank_cascade_q30(struct biquad_bank *b, float *buf, int n)
+{
+	struct biquad_lane_q30 c = b->q30;
+	s32 v[BIQUAD_LANES] = { 0 }, x[2][BIQUAD_LANES], y[2][BIQUAD_LANES];
+	int last = b->nr - 1;
+
+	memcpy(x, b->qx, sizeof(x));
+	memcpy(y, b->qy, sizeof(y));
+	for (int t = 0; t < n + last; t++)
+		BIQUAD_BANK_SKEW(biquad_lanes_q30_range_df1, biquad_bank_load, biquad_bank_store);
+	memcpy(b->qx, x, sizeof(x));
+	memcpy(b->qy, y, sizeof(y));
+}
+
+#else
+
+#define biquad_bank_float(x) (x)
+
+//
+// Where all the filters are busy, a step is one vector operation
+// for all of them, and moving up a lane is one shuffle. This needs
+// the hardware to take care of denormals, as there's no flush.
+//
+#if BIQUAD_LANES == 4 && defined(DENORMAL_HW)
+typedef float biquad_v4 __attribute__((vector_size(16)));
+typedef int biquad_v4i __attribute__((vector_size(16)));
+
+static inline int biquad_bank_skew_v4(const struct biquad_lane_coeff *c, float *buf, int t, int n,
+	int last, float v[4], float x[2][4], float y[2][4])
+{
+	biquad_v4 b0, b1, b2, a1, a2, x0, x1, y0, y1, val;
+
+	memcpy(&b0, c->b0, sizeof(b0));
+	memcpy(&b1, c->b1, sizeof(b1));
+	memcpy(&b2, c->b2, sizeof(b2));
+	memcpy(&a1, c->a1, sizeof(a1));
+	memcpy(&a2, c->a2, sizeof(a2));
+	memcpy(&x0, x[0], sizeof(x0));
+	memcpy(&x1, x[1], sizeof(x1));
+	memcpy(&y0, y[0], sizeof(y0));
+	memcpy(&y1, y[1], sizeof(y1));
+	memcpy(&val, v, sizeof(val));
+
+	for (; t < n; t++) {
+		biquad_v4 in = __builtin_shuffle(val, (biquad_v4) { buf[t] }, (biquad_v4i) { 4, 0, 1, 2 });
+
+		val = b0*in + b1*x0 + b2*x1 - a1*y0 - a2*y1;
+		x1 = x0; x0 = in;
+		y1 = y0; y0 = val;
+		buf[t-last] = val[last];
+	}
+
+	memcpy(x[0], &x0, sizeof(x0));
+	memcpy(x[1], &x1, sizeof(x1));
+	memcpy(y[0], &y0, sizeof(y0));
+	memcpy(y[1], &y1, sizeof(y1));
+	memcpy(v, &val, sizeof(val));
+	return t;
+}
+#endif
+
+static inline void biquad_bank_cascade_float(struct biquad_bank *b, float *buf, int n)
+{
+	struct biquad_lane_coeff c = b->coeff;
+	float v[BIQUAD_LANES] = { 0 }, x[2][BIQUAD_LANES], y[2][BIQUAD_LANES];
+	int last = b->nr - 1, t = 0;
+
+	memcpy(x, b->x, sizeof(x));
+	memcpy(y, b->y, sizeof(y));
+#if BIQUAD_LANES == 4 && defined(DENORMAL_HW)
+	for (; t < last && t < n; t++)
+		BIQUAD_BANK_SKEW(biquad_lanes_range_df1, biquad_bank_float, biquad_bank_float);
+	t = biquad_bank_skew_v4(&c, buf, t, n, last, v, x, y);
+#endif
+	for (; t < n + last; t++)
+		BIQUAD_BANK_SKEW(biquad_lanes_range_df1, biquad_bank_float, biquad_bank_float);
+	memcpy(b->x, x, sizeof(x));
+	memcpy(b->y, y, sizeof(y));
+}
+
+#endif
+
+// All 'n' samples of 'buf' through filter 0, then filter 1 and so on
+static inline void biquad_bank_cascade(struct biquad_bank *b, float *buf, int n)
+{
+	if (!b->nr)
+		return;
+#ifdef FIXED_POINT
+	biquad_bank_cascade_q30(b, buf, n);
+#else
+	biquad_bank_cascade_float(b, buf, n);
+#endif
+}
@@ -1,87 +1,436 @@
 #define _GNU_SOURCE
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
 #include <pthread.h>
+#include <signal.h>
 #include <math.h>
 
-#define SAMPLES_PER_SEC (48000.0)
-
-// Core utility functions and helpers
-#include "util.h"
-#include "lfo.h"
-#include "effect.h"
-#include "biquad.h"
-#include "process.h"
-
-// Effects
-#include "flanger.h"
-#include "echo.h"
-#include "fm.h"
-#include "am.h"
-#include "phaser.h"
-#include "discont.h"
-#include "distortion.h"
-#include "tube.h"
-#include "growlingbass.h"
-
-static void magnitude_describe(float pot[4]) { fprintf(stderr, "\n"); }
-static void magnitude_init(float pot[4]) {}
-static float magnitude_step(float in) { return u32_to_fraction(magnitude); }
-
-#define EFF(x) { #x, x##_describe, x##_init, x##_step }
-struct effect {
-	const char *name;
-	void (*describe)(float[4]);
-	void (*init)(float[4]);
-	float (*step)(float);
-} effects[] = {
-	EFF(discont),
-	EFF(distortion),
-	EFF(echo),
-	EFF(flanger),
-	EFF(phaser),
-	EFF(tube),
-	EFF(growlingbass),
-
-	/* "Helper" effects */
-	EFF(am),
-	EFF(fm),
-	EFF(magnitude),
+#include "effects.h"
+#include "queue.h"
+
+//
+// A chain of effects, each with its own state and pots.
+// "convert distortion,phaser,echo" runs them in that order
+// over every block, all in the same buffer.
+//
+// Everything one render needs is in 'struct render', so that the
+// batch mode can run many of them at once. The normal one-input
+// one-output case (and ALSA) just uses 'live'.
+//
+// With --channels=N the samples are N-channel interleaved, and every
+// stage has a separate state for each channel. The pots are shared.
+// Effects with a 'multi' function do all the channels in one go,
+// the rest get the block function called for each channel in turn.
+//
+// --rate=N sets the sample rate (48000 if not given), see util.h.
+// --ir=FILE is the impulse response for tube instead of FIR.raw,
+// see ir.h. Built with TIMING, it keeps track of how long every
+// block takes against its deadline, see timing.h.
+//
+#define MAX_CHAIN 8
+#define MAX_CHANNELS 8
+
+struct stage {
+	const struct effect *eff;
+	void *state[MAX_CHANNELS];
+	float pots[4];
+	int changed;
 };
 
-#define UPDATE(x) x += 0.001 * (target_##x - x)
+struct render {
+	struct stage chain[MAX_CHAIN];
+	int chain_len, blocks;
+	int channels;
+	float spread;		// LFO phase between channels, in cycles
+	struct process_state proc[MAX_CHANNELS];
+
+	// Analysis side-streams, see tap.h. 'analysis'
+	// is set if there are any of them at all
+	struct tap *taps;
+	int nr_taps, analysis;
+	struct peaks *in_peaks, *peaks;
+	struct stft *stft;
+
+	// Pot changes, see apply_events() below
+	struct param_queue pot_queue;
+	u32 sample_time;		// only touched by the audio side
+	atomic_uint published_time;	// .. which publishes it here
+
+	struct timing *timing;		// only 'live', with TIMING
+};
+
+static struct render live = { .channels = 1 };
 
 #define BLOCKSIZE 200
-static inline int make_one_noise(int in, int out, struct effect *eff)
+
+#include "peaks.h"
+#include "stft.h"
+#include "tap.h"
+#include "timing.h"
+
+#ifdef FIXED_POINT
+
+//
+// The fixed-point build keeps the samples in Q31 all through the
+// chain. Effects without a fixed-point version get each block
+// converted to float and back.
+//
+static void fixed_stage(struct stage *s, int ch, q31 *buf, int n)
+{
+	void *state = s->state[ch];
+	float tmp[BLOCKSIZE];
+
+	if (s->eff->fixed) {
+		s->eff->fixed(state, buf, buf, n);
+		return;
+	}
+
+	for (int i = 0; i < n; i++)
+		tmp[i] = q31_to_float(buf[i]);
+	if (s->eff->block)
+		s->eff->block(state, tmp, tmp, n);
+	else
+		for (int i = 0; i < n; i++)
+			tmp[i] = s->eff->step(state, tmp[i]);
+	for (int i = 0; i < n; i++)
+		buf[i] = float_to_q31(tmp[i]);
+}
+
+static void process_block(struct render *r, const s32 *in, s32 *out, int nr)
+{
+	int channels = r->channels;
+	q31 buffer[MAX_CHANNELS][BLOCKSIZE];
+
+	for (int ch = 0; ch < channels; ch++) {
+		struct process_state *ps = r->proc + ch;
+		q31 *buf = buffer[ch];
+
+		for (int i = 0; i < nr; i++) {
+			buf[i] = process_input_q31(ps, in[i*channels + ch]);
+			if (r->nr_taps)
+				tap_input(r, i, ch);
+		}
+
+		// Without block functions a stage at a time is
+		// just as good: it does a sample at a time in there
+		for (int j = 0; j < r->chain_len; j++) {
+			u64 start = timing_now();
+			fixed_stage(r->chain+j, ch, buf, nr);
+			timing_stage(r, j, start);
+			if (r->nr_taps)
+				for (int i = 0; i < nr; i++)
+					tap_stage(r, j+1, i, ch, buf[i]);
+		}
+
+		for (int i = 0; i < nr; i++)
+			out[i*channels + ch] = buf[i];
+	}
+	if (r->analysis)
+		tap_output(r, in, out, nr);
+}
+
+#else
+
+static void run_stage(struct stage *s, float **buf, int channels, int n)
+{
+	if (channels > 1 && s->eff->multi) {
+		s->eff->multi(s->state, buf, channels, n);
+		return;
+	}
+	for (int ch = 0; ch < channels; ch++)
+		s->eff->block(s->state[ch], buf[ch], buf[ch], n);
+}
+
+static void process_block(struct render *r, const s32 *in, s32 *out, int nr)
+{
+	struct stage *chain = r->chain;
+	int channels = r->channels;
+	float buffer[MAX_CHANNELS][BLOCKSIZE];
+	float *buf[MAX_CHANNELS];
+
+	if (r->blocks) {
+		for (int ch = 0; ch < channels; ch++) {
+			buf[ch] = buffer[ch];
+			for (int i = 0; i < nr; i++) {
+				buffer[ch][i] = process_input(r->proc + ch, in[i*channels + ch]);
+				if (r->nr_taps)
+					tap_input(r, i, ch);
+			}
+		}
+
+		for (int j = 0; j < r->chain_len; j++) {
+			u64 start = timing_now();
+			run_stage(chain+j, buf, channels, nr);
+			timing_stage(r, j, start);
+			if (r->nr_taps)
+				for (int ch = 0; ch < channels; ch++)
+					for (int i = 0; i < nr; i++)
+						tap_stage(r, j+1, i, ch, process_output(buffer[ch][i]));
+		}
+
+		for (int ch = 0; ch < channels; ch++)
+			for (int i = 0; i < nr; i++)
+				out[i*channels + ch] = process_output(buffer[ch][i]);
+	} else {
+		for (int i = 0; i < nr*channels; i++) {
+			int ch = i % channels;
+			float val = process_input(r->proc + ch, in[i]);
+			if (r->nr_taps)
+				tap_input(r, i / channels, ch);
+
+			for (int j = 0; j < r->chain_len; j++) {
+				val = chain[j].eff->step(chain[j].state[ch], val);
+				if (r->nr_taps)
+					tap_stage(r, j+1, i / channels, ch, process_output(val));
+			}
+
+			out[i] = process_output(val);
+		}
+	}
+	if (r->analysis)
+		tap_output(r, in, out, nr);
+}
+
+#endif
+
+//
+// Pot changes come from the control thread through 'pot_queue',
+// timestamped with the sample they should take effect at. The
+// audio side splits the block at each event, and only re-inits
+// the stages whose pots actually changed.
+//
+// Apply everything that is due now, and return
+// how many samples there are until the next event
+static int apply_events(struct render *r, int n)
+{
+	const struct param_event *ev;
+
+	while ((ev = param_queue_peek(&r->pot_queue)) != NULL) {
+		s32 delta = ev->time - r->sample_time;
+		if (delta > 0) {
+			if (delta < n)
+				n = delta;
+			break;
+		}
+
+		struct stage *s = r->chain + ev->idx / 4;
+		float *pot = s->pots + ev->idx % 4;
+		if (*pot != ev->value) {
+			*pot = ev->value;
+			s->changed = 1;
+		}
+		param_queue_pop(&r->pot_queue);
+	}
+
+	for (int i = 0; i < r->chain_len; i++) {
+		struct stage *s = r->chain+i;
+		if (s->changed) {
+			for (int ch = 0; ch < r->channels; ch++)
+				s->eff->init(s->state[ch], s->pots);
+			s->changed = 0;
+		}
+	}
+	return n;
+}
+
+// 'nr' frames of r->channels interleaved samples
+static void render_block(struct render *r, const s32 *in, s32 *out, int nr)
 {
-	s32 input[BLOCKSIZE], output[BLOCKSIZE];
-	int nr = read(in, input, sizeof(input));
+	u64 start = timing_now();
+	int frames = nr;
+
+	while (nr > 0) {
+		int n = apply_events(r, nr);
+
+		process_block(r, in, out, n);
+		in += n * r->channels; out += n * r->channels; nr -= n;
+		r->sample_time += n;
+	}
+	atomic_store_explicit(&r->published_time, r->sample_time, memory_order_release);
+	timing_block(r, frames, start);
+}
+
+// Allocate the effect state for a chain that has its effects and pots
+static void render_setup(struct render *r)
+{
+	r->blocks = 1;
+	for (int i = 0; i < r->chain_len; i++) {
+		struct stage *s = r->chain+i;
+
+		for (int ch = 0; ch < r->channels; ch++) {
+			s->state[ch] = calloc(1, s->eff->size);
+			if (!s->state[ch] && s->eff->size) {
+				perror("calloc");
+				exit(1);
+			}
+
+			// Linked LFOs: the same LFO, with the
+			// channels 'spread' of a cycle apart
+			if (s->eff->lfo)
+				s->eff->lfo(s->state[ch])->idx = (u32) (fmod(ch * r->spread, 1.0) * TWO_POW_32);
+		}
+		if (!s->eff->block)
+			r->blocks = 0;
+		s->changed = 1;
+	}
+	for (int ch = 0; ch < r->channels; ch++)
+		process_init(r->proc + ch);
+}
+
+static void render_free(struct render *r)
+{
+	for (int i = 0; i < r->chain_len; i++)
+		for (int ch = 0; ch < r->channels; ch++)
+			effect_free(r->chain[i].eff, r->chain[i].state[ch]);
+}
+
+static inline int make_one_noise(struct render *r, int in, int out)
+{
+	s32 input[BLOCKSIZE * MAX_CHANNELS], output[BLOCKSIZE * MAX_CHANNELS];
+	int frame = 4 * r->channels;
+	u64 start = timing_now();
+	int nr = read(in, input, BLOCKSIZE * frame);
 	if (nr <= 0)
 		return nr;
 
-	nr /= 4;
-	for (int i = 0; i < nr; i++) {
-		UPDATE(effect_delay);
+	// A pipe can split a frame: wait for the rest of it
+	while (nr % frame) {
+		int n = read(in, (char *) input + nr, frame - nr % frame);
+		if (n <= 0)
+			break;
+		nr += n;
+	}
+	timing_read(r, start);
+
+	nr /= frame;
+	render_block(r, input, output, nr);
+	start = timing_now();
+	write(out, output, nr * frame);
+	timing_write(r, start);
+	return nr * frame;
+}
 
-		float val = process_input(input[i]);
+// Any partial frame at the end is left alone
+static void render_buffer(struct render *r, const s32 *src, s32 *dst, size_t samples)
+{
+	size_t frames = samples / r->channels;
 
-		val = eff->step(val);
+	for (size_t pos = 0; pos < frames; pos += BLOCKSIZE) {
+		size_t nr = frames - pos;
+		if (nr > BLOCKSIZE)
+			nr = BLOCKSIZE;
 
-		output[i] = process_output(val);
+		render_block(r, src + pos * r->channels, dst + pos * r->channels, nr);
 	}
-	write(out, output, nr * 4);
-	return nr * 4;
 }
 
+// Size the output file and map it for writing
+static s32 *map_output(int out, size_t size)
+{
+	if (ftruncate(out, size))
+		return NULL;
+
+	s32 *dst = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, out, 0);
+	if (dst == MAP_FAILED)
+		return NULL;
+	madvise(dst, size, MADV_SEQUENTIAL);
+	return dst;
+}
+
+//
+// Offline rendering from one regular file to another: map them
+// both and process straight from one mapping into the other, so
+// that there are no read/write system calls at all.
+//
+// Returns zero if the files can't be mapped, and the caller
+// should fall back to make_one_noise().
+//
+static int render_mapped(struct render *r, int in, int out)
+{
+	struct stat ist, ost;
+
+	if (fstat(in, &ist) || !S_ISREG(ist.st_mode))
+		return 0;
+	if (fstat(out, &ost) || !S_ISREG(ost.st_mode))
+		return 0;
+
+	size_t size = ist.st_size & ~3;
+	if (!size)
+		return 0;
+
+	const s32 *src = mmap(NULL, size, PROT_READ, MAP_PRIVATE, in, 0);
+	if (src == MAP_FAILED)
+		return 0;
+	s32 *dst = map_output(out, size);
+	if (!dst) {
+		munmap((void *) src, size);
+		return 0;
+	}
+	madvise((void *) src, size, MADV_SEQUENTIAL);
+
+	render_buffer(r, src, dst, size / 4);
+
+	munmap((void *) src, size);
+	munmap(dst, size);
+	return 1;
+}
+
+#ifdef ALSA
+#include "alsa.h"
+#endif
+
 static int pot_control = -1;
-static float pots[4] = { 0.5, 0.5, 0.5, 0.5 };
+
+static void describe_chain(struct render *r)
+{
+	for (int j = 0; j < r->chain_len; j++) {
+		fprintf(stderr, "%s%s:", j ? "  " : "", r->chain[j].eff->name);
+		r->chain[j].eff->describe(r->chain[j].pots);
+	}
+}
+
+// Parse "name[,name...]" into the effect chain
+static int parse_chain(struct render *r, const char *arg)
+{
+	for (int n = 0; ; n++) {
+		const char *end = strchrnul(arg, ',');
+		const struct effect *eff = find_effect(arg, end - arg);
+
+		if (!eff || n == MAX_CHAIN)
+			return 0;
+		r->chain[n].eff = eff;
+		if (!*end) {
+			r->chain_len = n+1;
+			return 1;
+		}
+		arg = end+1;
+	}
+}
+
+#include "batch.h"
+
+//
+// The pot index is across the whole chain, so
+// "p512" sets the second pot of the second effect.
+//
+// The control thread has its own copy of the pots just for
+// describing them, and every change lands exactly CONTROL_LATENCY
+// samples after the last block the audio side had finished.
+//
+#define CONTROL_LATENCY BLOCKSIZE
+static float control_pots[MAX_CHAIN][4];
 
 static void *modify_pots(void *arg)
 {
-	struct effect *eff = arg;
+	struct render *r = arg;
 
 	for (;;) {
 		char buf[5];
@@ -93,10 +442,20 @@ static void *modify_pots(void *arg)
 			unsigned int idx = buf[1]-'0';
 			unsigned int d1 = buf[2]-'0';
 			unsigned int d2 = buf[3]-'0';
-			if (idx > 3 || d1 > 9 || d2 > 9)
+			if (idx >= 4*r->chain_len || d1 > 9 || d2 > 9)
 				break;
-			pots[idx] = (d1*10+d2) / 100.0;
-			eff->describe(pots);
+
+			struct param_event ev = {
+				.time = atomic_load_explicit(&r->published_time, memory_order_acquire) + CONTROL_LATENCY,
+				.idx = idx,
+				.value = (d1*10+d2) / 100.0,
+			};
+			while (!param_queue_push(&r->pot_queue, &ev))
+				usleep(1000);
+
+			float *pots = control_pots[idx / 4];
+			pots[idx % 4] = ev.value;
+			r->chain[idx / 4].eff->describe(pots);
 			break;
 		}
 	}
@@ -104,14 +463,54 @@ static void *modify_pots(void *arg)
 
 int main(int argc, char **argv)
 {
-	struct effect *eff = NULL;
+	struct render *r = &live;
 	int input = -1, output = -1;
-	int potnr = 0;
+	int potnr = 0, nfiles = 0;
+	const char *files[argc];
+
+	for (int i = 0; i < MAX_CHAIN; i++)
+		for (int j = 0; j < 4; j++)
+			r->chain[i].pots[j] = 0.5;
 
 	for (int i = 1; i < argc; i++) {
 		const char *arg = argv[i];
 		char *endptr;
 
+#ifdef ALSA
+		if (alsa_option(arg))
+			continue;
+#endif
+		if (batch_option(arg))
+			continue;
+
+		if (tap_option(r, arg) || stft_option(arg))
+			continue;
+
+		if (!strncmp(arg, "--channels=", 11)) {
+			r->channels = atoi(arg+11);
+			if (r->channels >= 1 && r->channels <= MAX_CHANNELS)
+				continue;
+			fprintf(stderr, "Bad channel count (%s)\n", arg);
+			exit(1);
+		}
+
+		if (!strncmp(arg, "--rate=", 7)) {
+			if (!set_sample_rate(atoi(arg+7)))
+				continue;
+			fprintf(stderr, "Bad sample rate (%s)\n", arg);
+			exit(1);
+		}
+
+		if (!strncmp(arg, "--ir=", 5)) {
+			tube_ir = arg+5;
+			continue;
+		}
+
+		if (!strncmp(arg, "--spread=", 9)) {
+			r->spread = strtof(arg+9, NULL);
+			continue;
+		}
+
 		if (!strncmp(arg, "--control=", 10)) {
 			pot_control = strtol(arg+10, &endptr, 0);
 			if (endptr != arg+10)
@@ -121,63 +520,88 @@ int main(int argc, char **argv)
 		}
 
 		// Is the argument a floating point number?
-		// The we assume it's a default pot value
+		// The we assume it's a default pot value,
+		// four for each effect in the chain
 		float val = strtof(arg, &endptr);
 		if (endptr != arg) {
-			if (potnr < 4) {
-				pots[potnr++] = val;
+			if (potnr < 4*MAX_CHAIN) {
+				r->chain[potnr / 4].pots[potnr % 4] = val;
+				potnr++;
 				continue;
 			}
 			fprintf(stderr, "Too many pot values\n");
 			exit(1);
 		}
 
-		// Is it the name of an effect and we don't have one yet?
-		if (!eff) {
-			for (int i = 0; i < ARRAY_SIZE(effects); i++) {
-				if (!strcmp(arg, effects[i].name))
-					eff = effects+i;
-			}
-			if (eff)
-				continue;
-		}
+		// Is it the name of an effect (or a comma-separated
+		// chain of them) and we don't have one yet?
+		if (!r->chain_len && parse_chain(r, arg))
+			continue;
 
-		if (input < 0) {
-			// We assume first filename is an input file
-			if (!strcmp(arg, "-")) {
-				input = 0;
-				continue;
-			}
+		// Otherwise it's a file name. Which files are
+		// what depends on whether this is a batch
+		files[nfiles++] = arg;
+	}
 
-			int fd = open(arg, O_RDONLY);
-			if (fd < 0) {
-				perror(arg);
-				exit(1);
-			}
-			input = fd;
-			continue;
-		}
+	if (!r->chain_len) {
+		fprintf(stderr, "No effect specified\n");
+		exit(1);
+	}
+	if (potnr > 4*r->chain_len) {
+		fprintf(stderr, "Too many pot values\n");
+		exit(1);
+	}
 
-		if (output < 0) {
-			// We assume second filename is an output file
-			if (!strcmp(arg, "-")) {
-				output = 1;
-				continue;
-			}
+	if (tap_wanted(r) && batch_dir) {
+		fprintf(stderr, "Taps, --peaks and --stft don't work with --batch\n");
+		exit(1);
+	}
+#ifdef ALSA
+	// No file writes from the audio thread
+	if (tap_wanted(r) && alsa_device) {
+		fprintf(stderr, "Taps, --peaks and --stft don't work with --alsa\n");
+		exit(1);
+	}
+#endif
 
-			int fd = open(arg, O_CREAT | O_WRONLY, 0666);
-			if (fd < 0) {
-				perror(arg);
-				exit(1);
-			}
-			output = fd;
-			continue;
-		}
+	// Before the batch workers or the control thread
+	fir_select();
+
+	if (batch_dir) {
+		for (int i = 0; i < nfiles; i++)
+			batch_add_input(files[i]);
+		return batch_run(r);
+	}
 
-		fprintf(stderr, "Unrecognized option '%s'\n", arg);
+	if (nfiles > 2) {
+		fprintf(stderr, "Unrecognized option '%s'\n", files[2]);
 		exit(1);
 	}
 
+	// We assume first filename is an input file,
+	// and the second one is an output file
+	if (nfiles > 0 && strcmp(files[0], "-")) {
+		input = open(files[0], O_RDONLY);
+		if (input < 0) {
+			perror(files[0]);
+			exit(1);
+		}
+	}
+	if (nfiles > 1 && strcmp(files[1], "-")) {
+		// Read-write so that it can be mapped
+		output = open(files[1], O_CREAT | O_RDWR, 0666);
+		if (output < 0) {
+			perror(files[1]);
+			exit(1);
+		}
+	}
+
+	render_setup(r);
+	timing_setup(r);
+	tap_open(r, input >= 0 ? files[0] : NULL, output >= 0 ? files[1] : NULL);
+	for (int i = 0; i < r->chain_len; i++)
+		memcpy(control_pots[i], r->chain[i].pots, sizeof(r->chain[i].pots));
+
 	if (input < 0)
 		input = 0;
 
@@ -192,18 +616,26 @@ int main(int argc, char **argv)
 	fcntl(output, F_SETPIPE_SZ, 4096);
 #endif
 
-	fprintf(stderr, "Playing %s: ",	eff->name);
-	eff->describe(pots);
+	fprintf(stderr, "Playing ");
+	describe_chain(r);
+
+	// Only the audio side (this thread) needs it
+	denormals_off();
 
 	pthread_t pot_thread;
 	if (pot_control >= 0)
-		pthread_create(&pot_thread, NULL, modify_pots, eff);
+		pthread_create(&pot_thread, NULL, modify_pots, r);
 
-	for (;;) {
-		eff->init(pots);
-		if (make_one_noise(input, output, eff) <= 0)
-			break;
+#ifdef ALSA
+	if (alsa_device)
+		return alsa_run(r);
+#endif
+
+	if (!render_mapped(r, input, output)) {
+		while (make_one_noise(r, input, output) > 0)
+			/* nothing */;
 	}
+	tap_close(r);
 
 	if (pot_control >= 0)
 		pthread_cancel(pot_thread);
@@ -0,0 +1,191 @@
+//
+// Uniformly partitioned overlap-save convolution
+//
+// The impulse response is split into partitions of 'B' samples.
+// The first partition (the "head") is done directly in the time
+// domain, so there is no added latency at all: every input sample
+// immediately shows up in the output.
+//
+// The rest of the IR (the "tail") only ever looks at input samples
+// from previous blocks, so it can be done in the frequency domain
+// once every B samples: FFT the last two input blocks, push that
+// spectrum into a delay line of spectra, multiply-accumulate it with
+// the pre-transformed IR partitions, and inverse FFT the sum. The
+// second half of the result is the tail contribution to the next B
+// output samples.
+//
+// That makes the per-sample cost roughly B multiply-adds for the
+// head (using the vectorized FIR kernel, so B has to be a multiple
+// of 8) plus a couple of FFTs and one complex multiply per partition
+// amortized over the block, rather than one multiply-add per tap.
+//
+struct convolver {
+	int B, parts;
+	int pos, fdl;
+	const float *head;	// B taps, reversed
+	const float *H;		// 'parts' packed spectra of 2B floats
+	float *X;		// ring of 'parts' input spectra
+	float *input;		// previous and current input block
+	float *tail;		// tail output for the current block
+	float *acc;		// 2B scratch
+	struct fft fft;
+
+	// What 'head' and 'H' are in, when it's ours to free
+	float *prepared;
+	void *map;
+	size_t map_size;
+};
+
+//
+// The IR as the convolver uses it: the head, and then the spectra of
+// the tail partitions, in one run of convolver_prepared_size() bytes.
+// That's what ir.h keeps in its cache files.
+//
+static inline int convolver_parts(int len, int B)
+{
+	return len > B ? (len - 1) / B : 0;
+}
+
+static inline size_t convolver_prepared_size(int len, int B)
+{
+	return (B + (size_t) convolver_parts(len, B) * 2 * B) * sizeof(float);
+}
+
+// 'fft' is of size 2B, and 'out' starts out zeroed
+static void convolver_prepare(const struct fft *fft, const float *ir, int len, int B, float *out)
+{
+	int n = 2*B, parts = convolver_parts(len, B);
+	float *head = out, *H = out + B;
+
+	for (int i = 0; i < B && i < len; i++)
+		head[B-1-i] = ir[i];
+
+	// The inverse FFT is scaled by B, fold the 1/B in here
+	for (int p = 0; p < parts; p++) {
+		float *h = H + p*n;
+		int start = (p+1) * B;
+
+		for (int i = 0; i < B && start+i < len; i++)
+			h[i] = ir[start+i] / B;
+		fft_forward(fft, h, h);
+	}
+}
+
+// Set up to run a prepared IR. That's used in place, so it has to
+// stay around for as long as the convolver does
+static int convolver_init_prepared(struct convolver *c, const float *prepared, int parts, int B)
+{
+	int n = 2*B;
+
+	memset(c, 0, sizeof(*c));
+	c->B = B;
+	c->parts = parts;
+	c->head = prepared;
+	c->H = prepared + B;
+	c->X = calloc(parts * n + 1, sizeof(float));
+	c->input = calloc(n, sizeof(float));
+	c->tail = calloc(B, sizeof(float));
+	c->acc = calloc(n, sizeof(float));
+	if (!c->X || !c->input || !c->tail || !c->acc || fft_init(&c->fft, n)) {
+		// 'prepared' is still the caller's
+		free(c->X);
+		free(c->input);
+		free(c->tail);
+		free(c->acc);
+		memset(c, 0, sizeof(*c));
+		return -1;
+	}
+	return 0;
+}
+
+static int convolver_init(struct convolver *c, const float *ir, int len, int B)
+{
+	float *prepared = calloc(1, convolver_prepared_size(len, B));
+
+	if (!prepared || convolver_init_prepared(c, prepared, convolver_parts(len, B), B)) {
+		free(prepared);
+		return -1;
+	}
+	c->prepared = prepared;
+	convolver_prepare(&c->fft, ir, len, B, prepared);
+	return 0;
+}
+
+static inline void convolver_free(struct convolver *c)
+{
+	free(c->prepared);
+	if (c->map)
+		munmap(c->map, c->map_size);
+	free(c->X);
+	free(c->input);
+	free(c->tail);
+	free(c->acc);
+	fft_free(&c->fft);
+}
+
+// The input block is complete: work out the tail for the next one
+static void convolver_tail(struct convolver *c)
+{
+	int B = c->B, n = 2*B;
+
+	if (c->parts) {
+		float *x = c->X + c->fdl*n;
+
+		fft_forward(&c->fft, c->input, x);
+
+		// Partition 'p' goes with the spectrum from 'p' blocks ago
+		memset(c->acc, 0, n * sizeof(float));
+		for (int p = 0; p < c->parts; p++) {
+			int slot = c->fdl - p;
+			if (slot < 0)
+				slot += c->parts;
+			fft_mac(n, c->acc, c->H + p*n, c->X + slot*n);
+		}
+		if (++c->fdl == c->parts)
+			c->fdl = 0;
+
+		fft_inverse(&c->fft, c->acc, c->acc);
+		memcpy(c->tail, c->acc + B, B * sizeof(float));
+	}
+
+	memcpy(c->input, c->input + B, B * sizeof(float));
+	c->pos = 0;
+}
+
+//
+// The last B input samples are always contiguous in 'input',
+// ending at the current one, so the head is just the FIR kernel.
+//
+static inline float convolver_step(struct convolver *c, float in)
+{
+	float out;
+
+	c->input[c->B + c->pos] = in;
+	fir_kernel(c->head, c->input + c->pos + 1, &out, 1, c->B);
+
+	out += c->tail[c->pos];
+	if (++c->pos == c->B)
+		convolver_tail(c);
+	return out;
+}
+
+// Run up to the end of the partition at a time.
+// 'in' and 'out' may be the same buffer
+static void convolver_block(struct convolver *c, const float *in, float *out, int n)
+{
+	while (n > 0) {
+		int m = c->B - c->pos;
+		if (m > n)
+			m = n;
+
+		memcpy(c->input + c->B + c->pos, in, m * sizeof(float));
+		fir_kernel(c->head, c->input + c->pos + 1, out, m, c->B);
+		for (int i = 0; i < m; i++)
+			out[i] += c->tail[c->pos + i];
+
+		c->pos += m;
+		if (c->pos == c->B)
+			convolver_tail(c);
+		in += m; out += m; n -= m;
+	}
+}
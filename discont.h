@@ -6,10 +6,11 @@
 // Approximate a pitch shifter. Not a great one, I'm
 // afraid.
 //
-struct {
+struct discont_state {
 	struct lfo_state lfo;
 	float step;
-} disco;
+	struct sample_array samples;
+};
 
 #define DISCONT_SHIFT 12
 #define DISCONT_STEPS (1 << DISCONT_SHIFT)
@@ -19,7 +20,7 @@ void discont_describe(float pot[4])
 	fprintf(stderr, " tonestep=%g\n", pow2(linear(pot[0], -1, 1)));
 }
 
-void discont_init(float pot[4])
+void discont_init(struct discont_state *disco, float pot[4])
 {
 	// Which direction do we walk the samples?
 	// Walking backwards lowers the pitch
@@ -27,31 +28,61 @@ void discont_init(float pot[4])
 	// Staying at the same delay keeps the pitch the same
 	//
 	float step = pow2(linear(pot[0], -1, 1));	//  0.5 .. 2
-	disco.step = step - 1;			// -0.5 .. 1
+	disco->step = step - 1;			// -0.5 .. 1
 
 	// We set the LFO to be 2*DISCONT_STEPS
 	// but then we basically just use half
 	// of it twice
-	disco.lfo.step = 1 << (31-DISCONT_SHIFT);
+	disco->lfo.step = 1 << (31-DISCONT_SHIFT);
+
+	// The longest delay is 2*DISCONT_STEPS with step = 1
+	effect_alloc_delay(&disco->samples, 2*DISCONT_STEPS);
 }
 
 // i is discontinuous when sin**2 is 0
 // ni is discontinuous when cos**2 (aka 1-sin**2) is 0
-float discont_step(float in)
+static inline float discont_sample(struct discont_state *disco, float in, u32 phase, float sin)
 {
-	// The 'idx << 1' is because we only use half the wave,
+	// The 'phase << 1' is because we only use half the wave,
 	// we'll use 'sin**2' that is the same in both halves
-	u32 i = (disco.lfo.idx << 1) >> (32 - DISCONT_SHIFT);
+	u32 i = (phase << 1) >> (32 - DISCONT_SHIFT);
 	int ni = (i + DISCONT_STEPS/2) & (DISCONT_STEPS-1);
-	float sin = lfo_step(&disco.lfo, lfo_sinewave);
 
-	float step = disco.step;
+	float step = disco->step;
 	float delay = step < 0 ? 0 : 2*DISCONT_STEPS*step;
 
-	sample_array_write(in);
+	sample_array_write(&disco->samples, in);
 	sin *= sin;
-	float d1 = sample_array_read(delay - i*step) * sin;
-	float d2 = sample_array_read(delay - ni*step) * (1-sin);
+	float d1 = sample_array_read(&disco->samples, delay - i*step) * sin;
+	float d2 = sample_array_read(&disco->samples, delay - ni*step) * (1-sin);
 
 	return d1+d2;
 }
+
+static inline float discont_step(struct discont_state *disco, float in)
+{
+	u32 phase = disco->lfo.idx;
+	float sin = lfo_step(&disco->lfo, lfo_sinewave);
+
+	return discont_sample(disco, in, phase, sin);
+}
+
+// The delay line reads can't be batched, because
+// they may be of the sample just written
+static void discont_block(struct discont_state *disco, const float *in, float *out, int n)
+{
+	float sin[EFFECT_CHUNK];
+
+	while (n > 0) {
+		int len = n < EFFECT_CHUNK ? n : EFFECT_CHUNK;
+		u32 phase = disco->lfo.idx, step = disco->lfo.step;
+
+		lfo_fill(&disco->lfo, lfo_sinewave, sin, len);
+		for (int i = 0; i < len; i++)
+			out[i] = discont_sample(disco, in[i], phase + i*step, sin[i]);
+		in += len; out += len; n -= len;
+	}
+}
+
+EFFECT_LFO(discont, lfo)
+DEFINE_EFFECT(discont, .lfo = discont_lfo_fn);
@@ -4,44 +4,44 @@
 // Provides soft clipping (overdrive) through hard clipping (fuzz)
 // with optional tone control via low-pass filter.
 //
-static struct {
-	float drive;
-	float tone_freq;
-	float level;
-	int mode;  // 0=soft (tanh), 1=hard clip, 2=asymmetric
-	struct biquad tone_filter;
-} distortion;
-
-static inline void distortion_describe(float pot[4])
-{
-	const char *mode_names[] = { "soft", "hard", "asymmetric" };
-
-	fprintf(stderr, " drive=%gx", linear(pot[0], 1, 50));
-	fprintf(stderr, " tone=%g Hz", pot_frequency(pot[1]));
-	fprintf(stderr, " level=%g", pot[2]);
-	fprintf(stderr, " mode=%s\n", mode_names[distortion.mode]);
-}
+// The clipping curves go through the table-driven waveshaper, with
+// the drive as the pre-gain. Build with DISTORTION_OVERSAMPLE=2 or 4
+// to run the clipping oversampled (at the cost of some latency).
+//
+// All the curvature is in the knee around +-1, so the table gets
+// baked for the drive it's used at: it spans DISTORTION_HEADROOM
+// times full scale at that drive, but never more than the range the
+// 50x drive needs. That puts 2048 entries across the knee at 1x and
+// still 64 at 50x, so the interpolation is within 2.4e-7 of the
+// curves at 1x, and 2.4e-4 only at the top of the drive range.
+//
+#ifndef DISTORTION_OVERSAMPLE
+  #define DISTORTION_OVERSAMPLE 1
+#endif
 
-static inline void distortion_init(float pot[4])
-{
-	// pot[0]: drive/gain (1x - 50x)
-	distortion.drive = linear(pot[0], 1, 50);
+// Drive goes up to 50x
+#define DISTORTION_RANGE 64
+#define DISTORTION_HEADROOM 2
 
-	// pot[1]: tone (roll off high frequencies, 220Hz - 6.5kHz)
-	distortion.tone_freq = pot_frequency(pot[1]);
-	biquad_lpf(&distortion.tone_filter, distortion.tone_freq, 0.707f);
+// Pot changes ramp in over this many ms
+#define DISTORTION_SMOOTH_MS 20
 
-	// pot[2]: output level (0 - 100%)
-	distortion.level = pot[2];
-
-	// pot[3]: mode selection
-	if (pot[3] < 0.33f)
-		distortion.mode = 0;  // soft clip (tanh)
-	else if (pot[3] < 0.66f)
-		distortion.mode = 1;  // hard clip
-	else
-		distortion.mode = 2;  // asymmetric
+struct distortion_state {
+	struct smooth drive;
+	struct smooth tone_freq;
+	struct smooth level;
+	int mode;  // 0=soft (tanh), 1=hard clip, 2=asymmetric
+	struct biquad tone_filter;
+	struct waveshaper shaper;
+};
 
+static inline int distortion_mode(float pot)
+{
+	if (pot < 0.33f)
+		return 0;  // soft clip (tanh)
+	if (pot < 0.66f)
+		return 1;  // hard clip
+	return 2;  // asymmetric
 }
 
 // Soft clipping using tanh approximation
@@ -69,29 +69,118 @@ static inline float asymmetric_clip(float x)
 		return soft_clip(x * 0.7f) * 0.7f;
 }
 
-static inline float distortion_step(float in)
+static float (*const distortion_curves[])(float) = {
+	soft_clip, hard_clip, asymmetric_clip
+};
+
+static inline void distortion_describe(float pot[4])
+{
+	const char *mode_names[] = { "soft", "hard", "asymmetric" };
+
+	fprintf(stderr, " drive=%gx", linear(pot[0], 1, 50));
+	fprintf(stderr, " tone=%g Hz", pot_frequency(pot[1]));
+	fprintf(stderr, " level=%g", pot[2]);
+	fprintf(stderr, " mode=%s\n", mode_names[distortion_mode(pot[3])]);
+}
+
+// Bake the table for 'mode' at 'drive', unless it already is
+static void distortion_bake(struct distortion_state *distortion, int mode, float drive)
 {
-	// Apply drive
-	float driven = in * distortion.drive;
-
-	// Apply waveshaping based on mode
-	float shaped;
-	switch (distortion.mode) {
-	case 0:
-		shaped = soft_clip(driven);
-		break;
-	case 1:
-		shaped = hard_clip(driven);
-		break;
-	case 2:
-	default:
-		shaped = asymmetric_clip(driven);
-		break;
+	float range = fminf(DISTORTION_HEADROOM * drive, DISTORTION_RANGE);
+
+	// A whole number of entries to +-1, where hard clipping has
+	// its corners: in between them the interpolation cuts them off
+	range = (WAVESHAPER_SIZE / 2) / floorf((WAVESHAPER_SIZE / 2) / range);
+
+	if (mode != distortion->mode || range != distortion->shaper.range)
+		waveshaper_bake(&distortion->shaper, distortion_curves[mode], range);
+	distortion->mode = mode;
+}
+
+static inline void distortion_init(struct distortion_state *distortion, float pot[4])
+{
+	// pot[0]: drive/gain (1x - 50x)
+	float drive = linear(pot[0], 1, 50);
+
+	// pot[1]: tone (roll off high frequencies, 220Hz - 6.5kHz)
+	float tone_freq = pot_frequency(pot[1]);
+
+	// pot[2]: output level (0 - 100%)
+	float level = pot[2];
+
+	// pot[3]: mode selection
+	int mode = distortion_mode(pot[3]);
+
+	// The first time around we just start out at the pot values
+	if (!distortion->shaper.oversample) {
+		if (waveshaper_init(&distortion->shaper, DISTORTION_OVERSAMPLE)) {
+			fprintf(stderr, "Out of memory for waveshaper\n");
+			exit(1);
+		}
+		smooth_init(&distortion->drive, smooth_exp, DISTORTION_SMOOTH_MS, drive);
+		smooth_init(&distortion->tone_freq, smooth_exp, DISTORTION_SMOOTH_MS, tone_freq);
+		smooth_init(&distortion->level, smooth_linear, DISTORTION_SMOOTH_MS, level);
+		biquad_lpf(&distortion->tone_filter, tone_freq, 0.707f);
+	}
+	smooth_set(&distortion->drive, drive);
+	smooth_set(&distortion->tone_freq, tone_freq);
+	smooth_set(&distortion->level, level);
+
+	// While the drive ramps, the table has to do both ends of it.
+	// It gets baked again for the new drive once that has settled
+	distortion_bake(distortion, mode, fmaxf(distortion->drive.value, drive));
+	waveshaper_set_gain(&distortion->shaper, distortion->drive.value);
+}
+
+// While drive or tone are ramping, update what depends on
+// them to where they will be after the next 'n' samples
+static inline void distortion_update(struct distortion_state *distortion, int n)
+{
+	if (!distortion->drive.settled) {
+		float drive = smooth_skip(&distortion->drive, n);
+
+		if (distortion->drive.settled)
+			distortion_bake(distortion, distortion->mode, drive);
+		waveshaper_set_gain(&distortion->shaper, drive);
 	}
+	if (!distortion->tone_freq.settled)
+		biquad_lpf(&distortion->tone_filter, smooth_skip(&distortion->tone_freq, n), 0.707f);
+}
+
+static inline float distortion_step(struct distortion_state *distortion, float in)
+{
+	distortion_update(distortion, 1);
+
+	// Apply drive and waveshaping
+	float shaped = waveshaper_step(&distortion->shaper, in);
 
 	// Apply tone filter
-	float filtered = biquad_step(&distortion.tone_filter, shaped);
+	float filtered = biquad_step(&distortion->tone_filter, shaped);
 
 	// Apply output level
-	return filtered * distortion.level;
+	return filtered * smooth_step(&distortion->level);
+}
+
+static void distortion_block(struct distortion_state *distortion, const float *in, float *out, int n)
+{
+	distortion_update(distortion, n);
+	waveshaper_block(&distortion->shaper, in, out, n);
+
+	// The level is almost always settled: no per-sample test then
+	if (distortion->level.settled) {
+		float level = distortion->level.value;
+		for (int i = 0; i < n; i++)
+			out[i] = biquad_step(&distortion->tone_filter, out[i]) * level;
+		return;
+	}
+	for (int i = 0; i < n; i++)
+		out[i] = biquad_step(&distortion->tone_filter, out[i]) * smooth_step(&distortion->level);
 }
+
+static inline void distortion_fini(struct distortion_state *distortion)
+{
+	waveshaper_free(&distortion->shaper);
+}
+
+EFFECT_FINI(distortion)
+DEFINE_EFFECT(distortion, .fini = distortion_fini_fn);
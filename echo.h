@@ -1,6 +1,10 @@
 //
 // Minimal echo effect
 //
+struct echo_state {
+	struct effect_common c;
+};
+
 static inline void echo_describe(float pot[4])
 {
 	fprintf(stderr, " delay=%g ms", pot[0] * 1000);
@@ -8,20 +12,69 @@ static inline void echo_describe(float pot[4])
 	fprintf(stderr, " feedback=%g\n", pot[3]);
 }
 
-static inline void echo_init(float pot[4])
+static inline void echo_init(struct echo_state *echo, float pot[4])
 {
-	effect_set_delay(pot[0] * 1000);	// delay = 0 .. 1s
-	effect_set_lfo_ms(pot[2]*4);	// LFO = 0 .. 4ms
-	effect_set_feedback(pot[3]);	// feedback = 0 .. 100%
+	effect_set_max_delay(&echo->c, 1000);
+	effect_set_delay(&echo->c, pot[0] * 1000);	// delay = 0 .. 1s
+	effect_set_lfo_ms(&echo->c, pot[2]*4);	// LFO = 0 .. 4ms
+	effect_set_feedback(&echo->c, pot[3]);	// feedback = 0 .. 100%
 }
 
-static inline float echo_step(float in)
+static inline float echo_step(struct echo_state *echo, float in)
 {
-	float d = 1 + effect_delay;
-	float out;
+	struct effect_common *c = &echo->c;
+	float d, out;
+
+	d = 1 + effect_update(c);
 
-	out = sample_array_read(d);
-	sample_array_write(limit_value(in + out * effect_feedback));
+	out = sample_array_read(&c->samples, d);
+	sample_array_write(&c->samples, limit_value(in + out * c->feedback));
 
 	return (in + out)/ 2;
 }
+
+// A settled delay is one contiguous read per chunk
+static void echo_block(struct echo_state *echo, const float *in, float *out, int n)
+{
+	struct effect_common *c = &echo->c;
+	float d[EFFECT_CHUNK], val[EFFECT_CHUNK];
+
+	while (n > 0) {
+		int len = effect_chunk(1 + effect_min_delay(c), n);
+
+		if (c->delay.settled) {
+			sample_array_read_block(&c->samples, 1 + c->delay.value, val, len);
+		} else {
+			for (int i = 0; i < len; i++)
+				d[i] = 1 + effect_update(c);
+			sample_array_gather(&c->samples, d, val, len);
+		}
+		effect_feedback_block(c, in, val, out, len);
+		in += len; out += len; n -= len;
+	}
+}
+
+#ifdef FIXED_POINT
+static void echo_fixed(struct echo_state *echo, const q31 *in, q31 *out, int n)
+{
+	struct effect_common *c = &echo->c;
+	float d[EFFECT_CHUNK];
+	q31 val[EFFECT_CHUNK];
+
+	while (n > 0) {
+		int len = effect_chunk(1 + effect_min_delay(c), n);
+
+		if (c->delay.settled) {
+			sample_array_read_block_q31(&c->samples, 1 + c->delay.value, val, len);
+		} else {
+			for (int i = 0; i < len; i++)
+				d[i] = 1 + effect_update(c);
+			sample_array_gather_q31(&c->samples, d, val, len);
+		}
+		effect_feedback_block_q31(c, in, val, out, len);
+		in += len; out += len; n -= len;
+	}
+}
+#endif
+
+DEFINE_FIXED_EFFECT(echo);
@@ -1,28 +1,351 @@
 //
-// Shared common state for most effects
+// The effect interface
+//
+// Every effect keeps all its state in its own 'struct <name>_state',
+// so that you can have several instances of the same effect (eg in a
+// chain). The effect functions take a pointer to that state, and
+// DEFINE_EFFECT() generates the type-safe glue to the generic
+// 'struct effect' that convert uses.
+//
+// Effects can provide a block function that processes 'n' samples at
+// a time ('in' and 'out' may be the same buffer). When 'block' is
+// NULL, the caller just loops over 'step'.
+//
+// In the fixed-point build, effects can also have a 'fixed' block
+// function that works on Q31 samples. Effects without one get the
+// block converted to float and back.
+//
+// For multi-channel audio there is one state per channel. A 'multi'
+// function gets all of them and a buffer for each channel, so that
+// it can process the channels side by side (see biquad_lanes). And
+// effects with an LFO can say where it is with 'lfo', for linking
+// the LFOs of the channels with a phase difference.
+//
+// Effects that allocate anything of their own (filters, tables, an
+// impulse response) give it back in 'fini', which effect_free() calls
+// before freeing the state itself.
+//
+// The optional ones go in the extra arguments of DEFINE_EFFECT(),
+// eg "DEFINE_EFFECT(phaser, .multi = phaser_multi)".
+//
+struct effect {
+	const char *name;
+	unsigned int size;
+	void (*describe)(float[4]);
+	void (*init)(void *, float[4]);
+	float (*step)(void *, float);
+	void (*block)(void *, const float *, float *, int);
+	void (*fixed)(void *, const q31 *, q31 *, int);
+	void (*multi)(void **, float **, int, int);
+	struct lfo_state *(*lfo)(void *);
+	void (*fini)(void *);
+};
+
+#define DEFINE_EFFECT(x, ...) _DEFINE_EFFECT(x, __VA_ARGS__)
+
+#define _DEFINE_EFFECT(x, ...)						\
+static void x##_init_fn(void *s, float pot[4])				\
+{ x##_init(s, pot); }							\
+static float x##_step_fn(void *s, float in)				\
+{ return x##_step(s, in); }						\
+static void x##_block_fn(void *s, const float *in, float *out, int n)	\
+{ x##_block(s, in, out, n); }						\
+static const struct effect x##_effect = {				\
+	.name = #x,							\
+	.size = sizeof(struct x##_state),				\
+	.describe = x##_describe,					\
+	.init = x##_init_fn,						\
+	.step = x##_step_fn,						\
+	.block = x##_block_fn,						\
+	__VA_ARGS__							\
+}
+
+// DEFINE_EFFECT() for effects that have an 'x_fixed()' function
+#ifdef FIXED_POINT
+#define DEFINE_FIXED_EFFECT(x, ...)					\
+static void x##_fixed_fn(void *s, const q31 *in, q31 *out, int n)	\
+{ x##_fixed(s, in, out, n); }						\
+_DEFINE_EFFECT(x, .fixed = x##_fixed_fn, __VA_ARGS__)
+#else
+#define DEFINE_FIXED_EFFECT(x, ...) DEFINE_EFFECT(x, __VA_ARGS__)
+#endif
+
+// The 'lfo' function for an LFO in the state
+#define EFFECT_LFO(x, member)						\
+static struct lfo_state *x##_lfo_fn(void *s)				\
+{ return &((struct x##_state *) s)->member; }
+
+// The 'fini' function, for an 'x_fini()'
+#define EFFECT_FINI(x)							\
+static void x##_fini_fn(void *s)					\
+{ x##_fini(s); }
+
+static inline void effect_free(const struct effect *eff, void *state)
+{
+	if (state && eff->fini)
+		eff->fini(state);
+	free(state);
+}
+
+//
+// The simple block function is just a loop over the step function, but
+// since the step functions are all inline that loop avoids the
+// indirect call per sample and lets the compiler unroll and
+// vectorize whatever it can.
+//
+#define STEP_TO_BLOCK(x)						\
+static void x##_block(struct x##_state *s, const float *in, float *out, int n) \
+{									\
+	for (int i = 0; i < n; i++)					\
+		out[i] = x##_step(s, in[i]);				\
+}
+
+//
+// Effects with optional stages can instead have init pick a block
+// function specialized for what is enabled, so that the per-sample
+// loops don't test for stages that aren't there. The state keeps
+// the choice in 'variant' (declared with EFFECT_VARIANT(x)), and
+// VARIANT_TO_BLOCK() generates the step and block functions that
+// call through it.
+//
+#define EFFECT_VARIANT(x)						\
+	void (*variant)(struct x##_state *, const float *, float *, int)
+
+#define VARIANT_TO_BLOCK(x)						\
+static inline float x##_step(struct x##_state *s, float in)		\
+{									\
+	s->variant(s, &in, &in, 1);					\
+	return in;							\
+}									\
+static void x##_block(struct x##_state *s, const float *in, float *out, int n) \
+{									\
+	s->variant(s, in, out, n);					\
+}
+
+//
+// Smoothed parameters
+//
+// Setting a new target makes the value ramp there instead of jumping,
+// so that turning a pot doesn't click. Linear ramps get there in
+// exactly the ramp time, exponential (one-pole) ones use it as the
+// time constant and snap to the target once they are within
+// SMOOTH_EPSILON of it (or the steps get lost in float rounding).
+// A plain one-pole doesn't snap: it stops wherever the rounding
+// leaves it, which for a delay of thousands of samples can be half
+// a sample short. The delay ramp has always done that.
+//
+// Once the value has reached the target the parameter is "settled":
+// stepping it is then just a test, and effects can skip recomputing
+// whatever depends on it (typically filter coefficients).
+//
+enum smooth_type {
+	smooth_linear,
+	smooth_exp,
+	smooth_onepole,
+};
+
+#define SMOOTH_EPSILON 1e-5f
+
+struct smooth {
+	float value, target;
+	float ms, rate;
+	enum smooth_type type;
+	int remaining;		// linear ramps only
+	int settled;
+};
+
+// Start out settled at 'value'
+static inline void smooth_init(struct smooth *s, enum smooth_type type, float ms, float value)
+{
+	s->type = type;
+	s->ms = ms;
+	s->value = s->target = value;
+	s->settled = 1;
+}
+
+static inline void smooth_set(struct smooth *s, float target)
+{
+	float samples = s->ms * SAMPLES_PER_MSEC;
+
+	if (target == s->target)
+		return;
+
+	s->target = target;
+	s->settled = samples <= 1;
+	if (s->settled) {
+		s->value = target;
+		return;
+	}
+	if (s->type == smooth_linear) {
+		s->remaining = (int) samples;
+		s->rate = (target - s->value) / s->remaining;
+	} else {
+		s->rate = 1 / samples;
+	}
+}
+
+static inline float smooth_step(struct smooth *s)
+{
+	if (s->settled)
+		return s->value;
+
+	if (s->type == smooth_linear) {
+		s->value += s->rate;
+		s->settled = !--s->remaining;
+	} else {
+		float diff = s->target - s->value;
+		float value = s->value + s->rate * diff;
+
+		// Also stop if the step has become too small to
+		// make a difference at float precision
+		s->settled = value == s->value || (s->type == smooth_exp &&
+			fabsf(diff) <= SMOOTH_EPSILON * fabsf(s->target) + 1e-9f);
+		s->value = value;
+		if (s->settled && s->type == smooth_onepole)
+			s->target = value;
+	}
+	if (s->settled)
+		s->value = s->target;
+	return s->value;
+}
+
+// Move 'n' samples ahead at once, for parameters used at control rate
+static inline float smooth_skip(struct smooth *s, int n)
+{
+	if (s->settled)
+		return s->value;
+
+	if (s->type == smooth_linear) {
+		if (n > s->remaining)
+			n = s->remaining;
+		s->value += n * s->rate;
+		s->remaining -= n;
+		s->settled = !s->remaining;
+	} else {
+		float diff = s->target - s->value;
+		diff *= fast_exp2(n * fast_log2(1 - s->rate));
+		s->value = s->target - diff;
+		s->settled = fabsf(diff) <= SMOOTH_EPSILON * fabsf(s->target) + 1e-9f;
+	}
+	if (s->settled)
+		s->value = s->target;
+	return s->value;
+}
+
+//
+// Shared common state for most delay-based effects
 //
 // The effects don't have to use these, but they are here to
-// make some basic things very simple to do.
+// make some basic things very simple to do. Embed it in the
+// effect state and use the helpers below.
 //
-float sample_array[SAMPLE_ARRAY_SIZE];
-int sample_array_index;
+struct effect_common {
+	float feedback;
+	struct smooth delay;
+	float depth;
+	struct lfo_state lfo;
+	struct sample_array samples;
+};
+
+#define effect_set_lfo(c,f)	set_lfo_freq(&(c)->lfo, f)
+#define effect_set_lfo_ms(c,ms)	set_lfo_ms(&(c)->lfo, ms)
+#define effect_set_depth(c,d)	(c)->depth = (d)
+#define effect_set_feedback(c,fb)	(c)->feedback = (fb)
+
+// Delay changes ramp with a time constant of 1000 samples
+#define EFFECT_DELAY_MS (1000 / SAMPLES_PER_MSEC)
 
-static float effect_feedback;
-static float effect_delay, target_effect_delay;
-static float effect_depth;
-static struct lfo_state effect_lfo;
+// The current delay in samples
+static inline float effect_update(struct effect_common *c)
+{
+	return smooth_step(&c->delay);
+}
 
-#define effect_set_lfo(f)	set_lfo_freq(&effect_lfo, f)
-#define effect_set_lfo_ms(ms)	set_lfo_ms(&effect_lfo, ms)
-#define effect_set_depth(d)	effect_depth = (d)
-#define effect_set_feedback(fb)	effect_feedback = (fb)
+// Get a delay line for up to 'samples' of delay, the first time only
+static inline void effect_alloc_delay(struct sample_array *sa, int samples)
+{
+	if (sa->data)
+		return;
+	if (sample_array_init(sa, samples)) {
+		fprintf(stderr, "Out of delay line memory\n");
+		exit(1);
+	}
+}
 
-#define SAMPLES_PER_MSEC (SAMPLES_PER_SEC * 0.001)
+// The effect reads at 1 + the delay, see below
+static inline void effect_set_max_delay(struct effect_common *c, float ms)
+{
+	effect_alloc_delay(&c->samples, 1 + (int) (ms * SAMPLES_PER_MSEC));
+}
 
-static inline void effect_set_delay(float ms)
+static inline void effect_set_delay(struct effect_common *c, float ms)
 {
 	float samples = ms * SAMPLES_PER_MSEC;
 
-	if (samples > 0 && samples < SAMPLE_ARRAY_SIZE)
-		target_effect_delay = samples;
+	if (samples <= 0 || 1 + samples > sample_array_max(&c->samples))
+		return;
+
+	// Like the one-pole this replaced, the delay starts out at zero
+	// and ramps up to the first one it gets
+	if (!c->delay.ms)
+		smooth_init(&c->delay, smooth_onepole, EFFECT_DELAY_MS, 0);
+	smooth_set(&c->delay, samples);
+}
+
+//
+// Block processing of the delay line: at most EFFECT_CHUNK samples
+// at a time, and no more than the shortest delay in the chunk so
+// that the reads can all be done before the writes.
+//
+#define EFFECT_CHUNK 64
+
+// The shortest the smoothed delay gets before it settles
+static inline float effect_min_delay(struct effect_common *c)
+{
+	return fminf(c->delay.value, c->delay.target);
+}
+
+// How many of 'n' samples to do in one go, with delays of at least 'min'
+static inline int effect_chunk(float min, int n)
+{
+	int len = (int) min;
+
+	if (len > n)
+		len = n;
+	if (len > EFFECT_CHUNK)
+		len = EFFECT_CHUNK;
+	return len < 1 ? 1 : len;
+}
+
+// Write the input plus feedback of the 'delayed' samples
+// back to the delay line, and output the two mixed
+static inline void effect_feedback_block(struct effect_common *c, const float *in,
+	const float *delayed, float *out, int n)
+{
+	float buf[EFFECT_CHUNK];
+
+	for (int i = 0; i < n; i++) {
+		float x = in[i], d = delayed[i];
+
+		buf[i] = limit_value(x + d * c->feedback);
+		out[i] = (x + d) / 2;
+	}
+	sample_array_write_block(&c->samples, buf, n);
+}
+
+#ifdef FIXED_POINT
+static inline void effect_feedback_block_q31(struct effect_common *c, const q31 *in,
+	const q31 *delayed, q31 *out, int n)
+{
+	q31 feedback = float_to_q31(c->feedback);
+	q31 buf[EFFECT_CHUNK];
+
+	for (int i = 0; i < n; i++) {
+		q31 x = in[i], d = delayed[i];
+
+		buf[i] = q31_limit((s64) x + q31_mul(d, feedback));
+		out[i] = (q31) (((s64) x + d) >> 1);
+	}
+	sample_array_write_block_q31(&c->samples, buf, n);
 }
+#endif
@@ -0,0 +1,66 @@
+//
+// Everything that goes into the effects, and the
+// table of effects that you can pick by name
+//
+// Needs the usual system headers. The sample rate is in util.h.
+//
+// Core utility functions and helpers
+#include "util.h"
+#include "lfo.h"
+#include "effect.h"
+#include "biquad.h"
+#include "process.h"
+#include "fir.h"
+#include "fft.h"
+#include "convolve.h"
+#include "ir.h"
+#include "waveshaper.h"
+
+// Effects
+#include "flanger.h"
+#include "echo.h"
+#include "fm.h"
+#include "am.h"
+#include "phaser.h"
+#include "discont.h"
+#include "distortion.h"
+#include "tube.h"
+#include "growlingbass.h"
+
+static void magnitude_describe(float pot[4]) { fprintf(stderr, "\n"); }
+static void magnitude_init(void *state, float pot[4]) {}
+static float magnitude_step(void *state, float in) { return u32_to_fraction(magnitude); }
+
+// No state, and no block function: it wants the
+// magnitude of every input sample as it is read
+static const struct effect magnitude_effect = {
+	.name = "magnitude",
+	.describe = magnitude_describe,
+	.init = magnitude_init,
+	.step = magnitude_step,
+};
+
+static const struct effect *effects[] = {
+	&discont_effect,
+	&distortion_effect,
+	&echo_effect,
+	&flanger_effect,
+	&phaser_effect,
+	&tube_effect,
+	&growlingbass_effect,
+
+	/* "Helper" effects */
+	&am_effect,
+	&fm_effect,
+	&magnitude_effect,
+};
+
+static const struct effect *find_effect(const char *name, int len)
+{
+	for (int i = 0; i < ARRAY_SIZE(effects); i++) {
+		const char *n = effects[i]->name;
+		if (strlen(n) == len && !memcmp(name, n, len))
+			return effects[i];
+	}
+	return NULL;
+}
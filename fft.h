@@ -0,0 +1,168 @@
+//
+// Very basic power-of-two FFT for real signals
+//
+// A real FFT of size 'n' is done as a complex FFT of size n/2 on the
+// even/odd samples (which is just the real array viewed as complex
+// pairs) followed by the usual split step.
+//
+// The spectrum is stored "packed" in n floats: (re,im) pairs for bins
+// 0 .. n/2-1, except that bin 0 is purely real and its imaginary slot
+// holds the (also purely real) bin n/2 instead.
+//
+// Nothing clever: radix-2, precomputed twiddles and bit reversal. The
+// tables are set up once, so the transforms themselves never call
+// sin/cos.
+//
+struct fft {
+	int n;			// real size
+	int *rev;		// bit reversal for the n/2 complex points
+	float *w;		// n/4 complex twiddles for the complex FFT
+	float *rw;		// n/4+1 complex twiddles for the split
+};
+
+static void fft_free(struct fft *f)
+{
+	free(f->rev);
+	free(f->w);
+	free(f->rw);
+}
+
+static int fft_init(struct fft *f, int n)
+{
+	int m = n / 2, bits = 0;
+
+	while ((1 << bits) < m)
+		bits++;
+
+	f->n = n;
+	f->rev = malloc(m * sizeof(int));
+	f->w = malloc((m/2+1) * 2 * sizeof(float));
+	f->rw = malloc((m/2+1) * 2 * sizeof(float));
+	if (!f->rev || !f->w || !f->rw) {
+		fft_free(f);
+		f->rev = NULL;
+		f->w = f->rw = NULL;
+		return -1;
+	}
+
+	for (int i = 0; i < m; i++) {
+		int r = 0;
+		for (int b = 0; b < bits; b++)
+			r |= ((i >> b) & 1) << (bits-1-b);
+		f->rev[i] = r;
+	}
+
+	// Forward twiddles are e^(-2*pi*i*k/size)
+	for (int k = 0; k <= m/2; k++) {
+		f->w[2*k]   = (float) cos(2*M_PI*k/m);
+		f->w[2*k+1] = (float) -sin(2*M_PI*k/m);
+		f->rw[2*k]   = (float) cos(2*M_PI*k/n);
+		f->rw[2*k+1] = (float) -sin(2*M_PI*k/n);
+	}
+	return 0;
+}
+
+// In-place complex FFT of n/2 points, 'dir' is -1 for inverse
+static void fft_complex(const struct fft *f, float *z, float dir)
+{
+	int m = f->n / 2;
+
+	for (int i = 0; i < m; i++) {
+		int j = f->rev[i];
+		if (j > i) {
+			float re = z[2*i], im = z[2*i+1];
+			z[2*i] = z[2*j]; z[2*i+1] = z[2*j+1];
+			z[2*j] = re; z[2*j+1] = im;
+		}
+	}
+
+	for (int len = 2; len <= m; len <<= 1) {
+		int half = len / 2, stride = m / len;
+		for (int i = 0; i < m; i += len) {
+			for (int k = 0; k < half; k++) {
+				float wr = f->w[2*k*stride];
+				float wi = f->w[2*k*stride+1] * dir;
+				float *a = z + 2*(i+k), *b = a + 2*half;
+				float tr = b[0]*wr - b[1]*wi;
+				float ti = b[0]*wi + b[1]*wr;
+
+				b[0] = a[0] - tr; b[1] = a[1] - ti;
+				a[0] += tr; a[1] += ti;
+			}
+		}
+	}
+}
+
+// Real to packed spectrum. 'in' and 'out' may be the same
+static void fft_forward(const struct fft *f, const float *in, float *out)
+{
+	int m = f->n / 2;
+
+	if (in != out)
+		memcpy(out, in, f->n * sizeof(float));
+	fft_complex(f, out, 1);
+
+	float re = out[0], im = out[1];
+	out[0] = re + im;
+	out[1] = re - im;
+
+	for (int k = 1; k <= m/2; k++) {
+		float *a = out + 2*k, *b = out + 2*(m-k);
+
+		// Even and odd sample spectra from the two mirror bins
+		float er = (a[0] + b[0]) / 2, ei = (a[1] - b[1]) / 2;
+		float or = (a[1] + b[1]) / 2, oi = (b[0] - a[0]) / 2;
+
+		// t = w^k * odd
+		float wr = f->rw[2*k], wi = f->rw[2*k+1];
+		float tr = or*wr - oi*wi, ti = or*wi + oi*wr;
+
+		a[0] = er + tr; a[1] = ei + ti;
+		b[0] = er - tr; b[1] = ti - ei;
+	}
+}
+
+//
+// Packed spectrum to real. Note that this is not normalized:
+// the result is scaled by n/2, and the caller is expected to
+// fold the 2/n into whatever it multiplied the spectrum with.
+//
+static void fft_inverse(const struct fft *f, const float *in, float *out)
+{
+	int m = f->n / 2;
+
+	if (in != out)
+		memcpy(out, in, f->n * sizeof(float));
+
+	float x0 = out[0], xm = out[1];
+	out[0] = (x0 + xm) / 2;
+	out[1] = (x0 - xm) / 2;
+
+	for (int k = 1; k <= m/2; k++) {
+		float *a = out + 2*k, *b = out + 2*(m-k);
+
+		float er = (a[0] + b[0]) / 2, ei = (a[1] - b[1]) / 2;
+		float dr = (a[0] - b[0]) / 2, di = (a[1] + b[1]) / 2;
+
+		// odd = d * conj(w^k)
+		float wr = f->rw[2*k], wi = f->rw[2*k+1];
+		float or = dr*wr + di*wi, oi = di*wr - dr*wi;
+
+		// z[k] = even + i*odd, z[m-k] = conj(even) + i*conj(odd)
+		a[0] = er - oi; a[1] = ei + or;
+		b[0] = er + oi; b[1] = or - ei;
+	}
+
+	fft_complex(f, out, -1);
+}
+
+// acc += a * b for packed spectra
+static inline void fft_mac(int n, float *acc, const float *a, const float *b)
+{
+	acc[0] += a[0] * b[0];
+	acc[1] += a[1] * b[1];
+	for (int i = 2; i < n; i += 2) {
+		acc[i]   += a[i]*b[i]   - a[i+1]*b[i+1];
+		acc[i+1] += a[i]*b[i+1] + a[i+1]*b[i];
+	}
+}
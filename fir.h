@@ -0,0 +1,183 @@
+//
+// Direct-form FIR kernels
+//
+// The kernel computes 'n' outputs at a time:
+//
+//	out[j] = sum(taps[k] * x[j+k]) for k = 0 .. len-1
+//
+// where the taps are stored reversed, so 'x' is just the history in
+// time order. That way there's no masking per tap, and the inner loop
+// is a plain dot product the CPU can do 4 or 8 lanes at a time.
+//
+// 'len' has to be a multiple of 8.
+//
+// The kernel is picked at runtime from what the CPU supports, so the
+// same binary does AVX2 on machines that have it. NEON is always there
+// on 64-bit ARM, and everything else (including the RP2354) gets the
+// unrolled scalar version.
+//
+// fir_select() picks it, and has to be called once at startup before
+// there are any threads (batch workers set up FIRs in parallel). Until
+// then it's the scalar one.
+//
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+typedef void fir_kernel_t(const float *taps, const float *x, float *out, int n, int len);
+
+static void fir_kernel_scalar(const float *taps, const float *x, float *out, int n, int len)
+{
+	for (int j = 0; j < n; j++, x++) {
+		float s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+
+		for (int k = 0; k < len; k += 4) {
+			s0 += taps[k+0] * x[k+0];
+			s1 += taps[k+1] * x[k+1];
+			s2 += taps[k+2] * x[k+2];
+			s3 += taps[k+3] * x[k+3];
+		}
+		out[j] = (s0 + s1) + (s2 + s3);
+	}
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2,fma")))
+static void fir_kernel_avx2(const float *taps, const float *x, float *out, int n, int len)
+{
+	for (int j = 0; j < n; j++, x++) {
+		__m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+		int k = 0;
+
+		for (; k + 16 <= len; k += 16) {
+			s0 = _mm256_fmadd_ps(_mm256_loadu_ps(taps+k), _mm256_loadu_ps(x+k), s0);
+			s1 = _mm256_fmadd_ps(_mm256_loadu_ps(taps+k+8), _mm256_loadu_ps(x+k+8), s1);
+		}
+		if (k < len)
+			s0 = _mm256_fmadd_ps(_mm256_loadu_ps(taps+k), _mm256_loadu_ps(x+k), s0);
+
+		s0 = _mm256_add_ps(s0, s1);
+		__m128 s = _mm_add_ps(_mm256_castps256_ps128(s0), _mm256_extractf128_ps(s0, 1));
+		s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+		s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+		out[j] = _mm_cvtss_f32(s);
+	}
+}
+#endif
+
+#ifdef __ARM_NEON
+static void fir_kernel_neon(const float *taps, const float *x, float *out, int n, int len)
+{
+	for (int j = 0; j < n; j++, x++) {
+		float32x4_t s0 = vdupq_n_f32(0), s1 = vdupq_n_f32(0);
+
+		for (int k = 0; k < len; k += 8) {
+			s0 = vfmaq_f32(s0, vld1q_f32(taps+k), vld1q_f32(x+k));
+			s1 = vfmaq_f32(s1, vld1q_f32(taps+k+4), vld1q_f32(x+k+4));
+		}
+		out[j] = vaddvq_f32(vaddq_f32(s0, s1));
+	}
+}
+#endif
+
+static fir_kernel_t *fir_kernel = fir_kernel_scalar;
+static const char *fir_kernel_name = "scalar";
+
+static void fir_select(void)
+{
+	fir_kernel = fir_kernel_scalar;
+	fir_kernel_name = "scalar";
+#if defined(__x86_64__) || defined(__i386__)
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+		fir_kernel = fir_kernel_avx2;
+		fir_kernel_name = "avx2";
+	}
+#endif
+#ifdef __ARM_NEON
+	fir_kernel = fir_kernel_neon;
+	fir_kernel_name = "neon";
+#endif
+}
+
+//
+// A stand-alone FIR with its own history
+//
+// The history is a linear buffer of twice the FIR length that we just
+// append to, so the last 'len' samples are always contiguous with no
+// wrap-around. When it fills up, the newest 'len' samples get copied
+// back down to the start, which costs about one copy per sample but
+// means a whole run of samples can be appended and then filtered with
+// a single kernel call.
+//
+struct fir {
+	int len, pos;
+	float *taps;
+	float *hist;
+};
+
+#define FIR_ALIGN(n) (((n) + 7) & ~7)
+
+static inline void fir_free(struct fir *f)
+{
+	free(f->taps);
+	free(f->hist);
+}
+
+static inline int fir_init(struct fir *f, const float *taps, int len)
+{
+	int padded = FIR_ALIGN(len);
+
+	f->len = padded;
+	f->pos = padded;
+	f->taps = calloc(padded, sizeof(float));
+	f->hist = calloc(2*padded, sizeof(float));
+	if (!f->taps || !f->hist) {
+		fir_free(f);
+		f->taps = f->hist = NULL;
+		return -1;
+	}
+
+	// Reversed, and any padding goes at the old end
+	for (int i = 0; i < len; i++)
+		f->taps[padded-1-i] = taps[i];
+	return 0;
+}
+
+// How many samples can we append before having to slide the history?
+static inline int fir_room(struct fir *f)
+{
+	if (f->pos == 2*f->len) {
+		memcpy(f->hist, f->hist + f->len, f->len * sizeof(float));
+		f->pos = f->len;
+	}
+	return 2*f->len - f->pos;
+}
+
+static inline float fir_step(struct fir *f, float in)
+{
+	float out;
+
+	fir_room(f);
+	f->hist[f->pos++] = in;
+	fir_kernel(f->taps, f->hist + f->pos - f->len, &out, 1, f->len);
+	return out;
+}
+
+// 'in' and 'out' may be the same buffer
+static inline void fir_block(struct fir *f, const float *in, float *out, int n)
+{
+	while (n > 0) {
+		int m = fir_room(f);
+		if (m > n)
+			m = n;
+
+		memcpy(f->hist + f->pos, in, m * sizeof(float));
+		fir_kernel(f->taps, f->hist + f->pos - f->len + 1, out, m, f->len);
+		f->pos += m;
+
+		in += m; out += m; n -= m;
+	}
+}
@@ -1,5 +1,9 @@
 // Flanger effect based on the MIT-licensed DaisySP library by Electrosmith
 // which in turn seems to be based on Soundpipe by Paul Batchelor
+struct flanger_state {
+	struct effect_common c;
+};
+
 static inline void flanger_describe(float pot[4])
 {
 	fprintf(stderr, " freq=%g Hz", pot[0]*pot[0]*10);
@@ -8,21 +12,75 @@ static inline void flanger_describe(float pot[4])
 	fprintf(stderr, " feedback=%g\n", pot[3]);
 }
 
-static inline void flanger_init(float pot[4])
+static inline void flanger_init(struct flanger_state *flanger, float pot[4])
 {
-	effect_set_lfo(pot[0]*pot[0]*10);	// lfo = 0 .. 10Hz
-	effect_set_delay(pot[1] * 4);		// delay = 0 .. 4 ms
-	effect_set_depth(pot[2]);		// depth = 0 .. 100%
-	effect_set_feedback(pot[3]);		// feedback = 0 .. 100%
+	struct effect_common *c = &flanger->c;
+
+	effect_set_lfo(c, pot[0]*pot[0]*10);	// lfo = 0 .. 10Hz
+	effect_set_max_delay(c, 2 * 4);		// the LFO can double it
+	effect_set_delay(c, pot[1] * 4);	// delay = 0 .. 4 ms
+	effect_set_depth(c, pot[2]);		// depth = 0 .. 100%
+	effect_set_feedback(c, pot[3]);		// feedback = 0 .. 100%
 }
 
-static inline float flanger_step(float in)
+static inline float flanger_step(struct flanger_state *flanger, float in)
 {
-	float d = 1 + effect_delay * (1 + lfo_step(&effect_lfo, lfo_sinewave) * effect_depth);
-	float out;
+	struct effect_common *c = &flanger->c;
+	float d, out;
+
+	d = 1 + effect_update(c) * (1 + lfo_step(&c->lfo, lfo_sinewave) * c->depth);
 
-	out = sample_array_read(d);
-	sample_array_write(limit_value(in + out * effect_feedback));
+	out = sample_array_read(&c->samples, d);
+	sample_array_write(&c->samples, limit_value(in + out * c->feedback));
 
 	return (in + out) / 2;
 }
+
+// The LFO takes the delay down to (1 - depth) of the base delay
+static inline int flanger_chunk(struct effect_common *c, int n)
+{
+	return effect_chunk(1 + effect_min_delay(c) * (1 - fabsf(c->depth)), n);
+}
+
+static inline void flanger_delays(struct effect_common *c, float *d, int n)
+{
+	lfo_fill(&c->lfo, lfo_sinewave, d, n);
+	for (int i = 0; i < n; i++)
+		d[i] = 1 + effect_update(c) * (1 + d[i] * c->depth);
+}
+
+static void flanger_block(struct flanger_state *flanger, const float *in, float *out, int n)
+{
+	struct effect_common *c = &flanger->c;
+	float d[EFFECT_CHUNK], val[EFFECT_CHUNK];
+
+	while (n > 0) {
+		int len = flanger_chunk(c, n);
+
+		flanger_delays(c, d, len);
+		sample_array_gather(&c->samples, d, val, len);
+		effect_feedback_block(c, in, val, out, len);
+		in += len; out += len; n -= len;
+	}
+}
+
+#ifdef FIXED_POINT
+static void flanger_fixed(struct flanger_state *flanger, const q31 *in, q31 *out, int n)
+{
+	struct effect_common *c = &flanger->c;
+	float d[EFFECT_CHUNK];
+	q31 val[EFFECT_CHUNK];
+
+	while (n > 0) {
+		int len = flanger_chunk(c, n);
+
+		flanger_delays(c, d, len);
+		sample_array_gather_q31(&c->samples, d, val, len);
+		effect_feedback_block_q31(c, in, val, out, len);
+		in += len; out += len; n -= len;
+	}
+}
+#endif
+
+EFFECT_LFO(flanger, c.lfo)
+DEFINE_FIXED_EFFECT(flanger, .lfo = flanger_lfo_fn);
@@ -3,8 +3,10 @@
 // It doesn't actually care about the input, it's useful
 // mainly for testing the LFO
 //
-static struct lfo_state base_lfo, modulator_lfo;
-static float fm_volume, fm_base_freq, fm_freq_range;
+struct fm_state {
+	struct lfo_state base_lfo, modulator_lfo;
+	float volume, base_freq, freq_range;
+};
 
 static inline void fm_describe(float pot[4])
 {
@@ -19,19 +21,41 @@ static inline void fm_describe(float pot[4])
 	fprintf(stderr, " lfo=%g Hz\n", 1 + 10*pot[3]);
 }
 
-static inline void fm_init(float pot[4])
+static inline void fm_init(struct fm_state *fm, float pot[4])
 {
-	fm_volume = pot[0];
-	fm_base_freq = pot_frequency(pot[1]);		// 220Hz - 6.5kHz
-	fm_freq_range = pot[2];				// 110Hz -  13kHz
-	set_lfo_freq(&modulator_lfo, 1 + 10*pot[3]);	// 1..11 Hz
+	fm->volume = pot[0];
+	fm->base_freq = pot_frequency(pot[1]);		// 220Hz - 6.5kHz
+	fm->freq_range = pot[2];			// 110Hz -  13kHz
+	set_lfo_freq(&fm->modulator_lfo, 1 + 10*pot[3]);	// 1..11 Hz
 }
 
-static inline float fm_step(float in)
+static inline float fm_step(struct fm_state *fm, float in)
 {
-	float lfo = lfo_step(&modulator_lfo, lfo_sinewave);
-	float multiplier = pow2(lfo * fm_freq_range);
-	float freq = fm_base_freq * multiplier;
-	set_lfo_freq(&base_lfo, freq);
-	return lfo_step(&base_lfo, lfo_sinewave) * fm_volume;
+	float lfo = lfo_step(&fm->modulator_lfo, lfo_sinewave);
+	float multiplier = pow2(lfo * fm->freq_range);
+	float freq = fm->base_freq * multiplier;
+	set_lfo_freq(&fm->base_lfo, freq);
+	return lfo_step(&fm->base_lfo, lfo_sinewave) * fm->volume;
 }
+
+// The modulator gives the carrier a new lfo step every sample
+static void fm_block(struct fm_state *fm, const float *in, float *out, int n)
+{
+	float step[EFFECT_CHUNK];
+
+	while (n > 0) {
+		int len = n < EFFECT_CHUNK ? n : EFFECT_CHUNK;
+
+		lfo_fill(&fm->modulator_lfo, lfo_sinewave, step, len);
+		for (int i = 0; i < len; i++) {
+			float freq = fm->base_freq * pow2(step[i] * fm->freq_range);
+			step[i] = freq * F_STEP;
+		}
+		lfo_fill_fm(&fm->base_lfo, lfo_sinewave, step, out, len);
+		for (int i = 0; i < len; i++)
+			out[i] *= fm->volume;
+		out += len; n -= len;
+	}
+}
+
+DEFINE_EFFECT(fm);
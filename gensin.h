@@ -0,0 +1,68 @@
+#define QUARTER_SINE_STEP_SHIFT 8
+const float quarter_sin[] = {
+	+0.00000000f, +0.00613588f, +0.01227154f, +0.01840673f,
+	+0.02454123f, +0.03067480f, +0.03680722f, +0.04293826f,
+	+0.04906768f, +0.05519524f, +0.06132074f, +0.06744392f,
+	+0.07356456f, +0.07968244f, +0.08579732f, +0.09190896f,
+	+0.09801714f, +0.10412164f, +0.11022221f, +0.11631863f,
+	+0.12241068f, +0.12849812f, +0.13458072f, +0.14065824f,
+	+0.14673047f, +0.15279719f, +0.15885815f, +0.16491313f,
+	+0.17096190f, +0.17700422f, +0.18303989f, +0.18906867f,
+	+0.19509033f, +0.20110464f, +0.20711139f, +0.21311033f,
+	+0.21910124f, +0.22508391f, +0.23105811f, +0.23702361f,
+	+0.24298019f, +0.24892760f, +0.25486567f, +0.26079412f,
+	+0.26671278f, +0.27262136f, +0.27851969f, +0.28440755f,
+	+0.29028468f, +0.29615091f, +0.30200595f, +0.30784966f,
+	+0.31368175f, +0.31950203f, +0.32531031f, +0.33110631f,
+	+0.33688987f, +0.34266073f, +0.34841868f, +0.35416354f,
+	+0.35989504f, +0.36561301f, +0.37131720f, +0.37700743f,
+	+0.38268344f, +0.38834505f, +0.39399205f, +0.39962420f,
+	+0.40524133f, +0.41084318f, +0.41642958f, +0.42200028f,
+	+0.42755509f, +0.43309384f, +0.43861624f, +0.44412217f,
+	+0.44961134f, +0.45508359f, +0.46053873f, +0.46597650f,
+	+0.47139676f, +0.47679924f, +0.48218377f, +0.48755017f,
+	+0.49289822f, +0.49822766f, +0.50353839f, +0.50883016f,
+	+0.51410278f, +0.51935599f, +0.52458970f, +0.52980365f,
+	+0.53499761f, +0.54017148f, +0.54532501f, +0.55045801f,
+	+0.55557023f, +0.56066159f, +0.56573184f, +0.57078074f,
+	+0.57580820f, +0.58081398f, +0.58579789f, +0.59075971f,
+	+0.59569932f, +0.60061651f, +0.60551104f, +0.61038282f,
+	+0.61523162f, +0.62005720f, +0.62485949f, +0.62963826f,
+	+0.63439332f, +0.63912444f, +0.64383156f, +0.64851443f,
+	+0.65317284f, +0.65780670f, +0.66241580f, +0.66699996f,
+	+0.67155896f, +0.67609272f, +0.68060102f, +0.68508366f,
+	+0.68954055f, +0.69397148f, +0.69837628f, +0.70275475f,
+	+0.70710680f, +0.71143222f, +0.71573082f, +0.72000252f,
+	+0.72424710f, +0.72846442f, +0.73265428f, +0.73681659f,
+	+0.74095115f, +0.74505779f, +0.74913641f, +0.75318682f,
+	+0.75720888f, +0.76120239f, +0.76516728f, +0.76910337f,
+	+0.77301045f, +0.77688848f, +0.78073725f, +0.78455663f,
+	+0.78834644f, +0.79210660f, +0.79583693f, +0.79953727f,
+	+0.80320754f, +0.80684758f, +0.81045720f, +0.81403634f,
+	+0.81758483f, +0.82110254f, +0.82458931f, +0.82804506f,
+	+0.83146964f, +0.83486287f, +0.83822472f, +0.84155496f,
+	+0.84485356f, +0.84812035f, +0.85135521f, +0.85455801f,
+	+0.85772864f, +0.86086698f, +0.86397284f, +0.86704624f,
+	+0.87008700f, +0.87309499f, +0.87607012f, +0.87901226f,
+	+0.88192130f, +0.88479709f, +0.88763962f, +0.89044873f,
+	+0.89322432f, +0.89596627f, +0.89867450f, +0.90134888f,
+	+0.90398929f, +0.90659570f, +0.90916799f, +0.91170605f,
+	+0.91420978f, +0.91667909f, +0.91911389f, +0.92151403f,
+	+0.92387953f, +0.92621025f, +0.92850609f, +0.93076698f,
+	+0.93299282f, +0.93518354f, +0.93733901f, +0.93945923f,
+	+0.94154407f, +0.94359347f, +0.94560734f, +0.94758562f,
+	+0.94952821f, +0.95143502f, +0.95330604f, +0.95514118f,
+	+0.95694035f, +0.95870349f, +0.96043054f, +0.96212143f,
+	+0.96377606f, +0.96539444f, +0.96697648f, +0.96852211f,
+	+0.97003127f, +0.97150391f, +0.97293995f, +0.97433938f,
+	+0.97570213f, +0.97702815f, +0.97831738f, +0.97956978f,
+	+0.98078530f, +0.98196387f, +0.98310549f, +0.98421010f,
+	+0.98527765f, +0.98630811f, +0.98730143f, +0.98825758f,
+	+0.98917651f, +0.99005821f, +0.99090264f, +0.99170976f,
+	+0.99247954f, +0.99321196f, +0.99390698f, +0.99456457f,
+	+0.99518473f, +0.99576742f, +0.99631262f, +0.99682030f,
+	+0.99729046f, +0.99772307f, +0.99811811f, +0.99847558f,
+	+0.99879546f, +0.99907773f, +0.99932239f, +0.99952942f,
+	+0.99969882f, +0.99983058f, +0.99992470f, +0.99998118f,
+	+1.00000000f, +1.00000000f
+};
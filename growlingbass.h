@@ -3,15 +3,30 @@
 // tunable odd/even harmonics distorsion
 // Author: Philippe Strauss <catseyechandra@proton.me>
 //
-static struct {
-	float level_sub;
-	float level_odd;
-	float level_even;
-	float tone_freq;
+// Pot changes ramp in over this many ms
+#define GROWLINGBASS_SMOOTH_MS 20
+
+// The sign detection doesn't see anything below -400dB, well clear
+// of the denormals (and the 1e-30 of flush_denormal())
+#define GROWLINGBASS_SILENCE 1e-20f
+
+struct growlingbass_state {
+	struct smooth level_sub;
+	struct smooth level_odd;
+	struct smooth level_even;
+	struct smooth tone_freq;
 	struct biquad lpf_in;
 	struct biquad lpf_odd;
 	struct biquad lpf_even;
-} growlingbass;
+
+	// for detecting and counting periods
+	unsigned nperiods;
+	float previous_sign;
+	// kind of envelope detection for ceil of hard_clip_growlingbass
+	// so the odd harmonics stay relative to the current amplitude
+	float previous_minmax;
+	float minmax;
+};
 
 static inline void growlingbass_describe(float pot[4])
 {
@@ -21,28 +36,50 @@ static inline void growlingbass_describe(float pot[4])
 	fprintf(stderr, " tone=%g Hz", pot_frequency(pot[3]));
 }
 
-static inline void growlingbass_init(float pot[4])
+// The odd and even harmonics get the same lowpass, so only work
+// it out once
+static inline void growlingbass_tone(struct growlingbass_state *growlingbass, float freq)
 {
-	// minus one octave subharmonic level
-	growlingbass.level_sub = pot[0];
+	biquad_lpf(&growlingbass->lpf_odd, freq, 0.707f);
+	growlingbass->lpf_even.coeff = growlingbass->lpf_odd.coeff;
+#ifdef FIXED_POINT
+	growlingbass->lpf_even.q30 = growlingbass->lpf_odd.q30;
+#endif
+}
 
-	// odd harmonics level
-	growlingbass.level_odd = pot[1];
+static inline void growlingbass_init(struct growlingbass_state *growlingbass, float pot[4])
+{
+	// cutoff frequency for the lowpass after the two distorsion stages
+	float tone_freq = pot_frequency(pot[3]);
 
-	// even harmonics level
-	growlingbass.level_even = pot[2];
+	// The state starts out zeroed, but the sign detection
+	// starts out negative. And the levels start out at
+	// the initial pot values.
+	if (!growlingbass->previous_sign) {
+		growlingbass->previous_sign = -1.0f;
 
-	// cutoff frequency for the lowpass after the two distorsion stages
-	growlingbass.tone_freq = pot_frequency(pot[3]);
+		smooth_init(&growlingbass->level_sub, smooth_linear, GROWLINGBASS_SMOOTH_MS, pot[0]);
+		smooth_init(&growlingbass->level_odd, smooth_linear, GROWLINGBASS_SMOOTH_MS, pot[1]);
+		smooth_init(&growlingbass->level_even, smooth_linear, GROWLINGBASS_SMOOTH_MS, pot[2]);
+		smooth_init(&growlingbass->tone_freq, smooth_exp, GROWLINGBASS_SMOOTH_MS, tone_freq);
+
+		// fixed input filter on the subharmonic chain
+		biquad_lpf(&growlingbass->lpf_in, 300.0f, 0.707f);
 
-	// fixed input filter on the subharmonic chain
-	biquad_lpf(&growlingbass.lpf_in, 300.0f, 0.707f);
+		// odd and even harmonics LPF biquad coeffs
+		growlingbass_tone(growlingbass, tone_freq);
+	}
+
+	// minus one octave subharmonic level
+	smooth_set(&growlingbass->level_sub, pot[0]);
 
-	// odd harmonics LPF biquad coeffs
-	biquad_lpf(&growlingbass.lpf_odd, growlingbass.tone_freq, 0.707f);
+	// odd harmonics level
+	smooth_set(&growlingbass->level_odd, pot[1]);
+
+	// even harmonics level
+	smooth_set(&growlingbass->level_even, pot[2]);
 
-	// even harmonics LPF biquad coeffs
-	biquad_lpf(&growlingbass.lpf_even, growlingbass.tone_freq, 0.707f);
+	smooth_set(&growlingbass->tone_freq, tone_freq);
 }
 
 // Hard clipping
@@ -60,50 +97,57 @@ static inline float sgn(float x)
 	return -1.0f;
 }
 
-static inline float growlingbass_step(float in)
+static inline float growlingbass_step(struct growlingbass_state *growlingbass, float in)
 {
-	static unsigned nperiods = 0;
-	static float previous_sign = -1.0f;
-	// kind of envelope detection for ceil of hard_clip_growlingbass
-	// so the odd harmonics stay relative to the current amplitude
-	static float previous_minmax = 0.0f;
-	static float minmax = 0.0f;
 	float shaped_sub = 0.0f;
 
-	float filtered_in = biquad_step(&growlingbass.lpf_in, in);
+	// Only recompute the tone filters while the tone is changing
+	if (!growlingbass->tone_freq.settled) {
+		growlingbass_tone(growlingbass, smooth_step(&growlingbass->tone_freq));
+	}
+
+	float filtered_in = biquad_step(&growlingbass->lpf_in, in);
 	// odd harmonics: hard_clip
-	float shaped_odd = hard_clip_growlingbass(filtered_in, previous_minmax);
+	float shaped_odd = hard_clip_growlingbass(filtered_in, growlingbass->previous_minmax);
 	// even harmonics (high pitched)
 	float shaped_even = fabsf(in);
-	float sign = sgn(filtered_in);
+	// Silence keeps the sign there was, so that a decaying tail
+	// doesn't go on counting periods down to wherever (and however)
+	// denormals get flushed to zero
+	float sign = fabsf(filtered_in) < GROWLINGBASS_SILENCE ?
+		growlingbass->previous_sign : sgn(filtered_in);
 
 	// if we're on the rising edge of sgn(), we are starting a new period
-	if ((sign - previous_sign) > 1.0f) {
-		nperiods += 1;
-		previous_minmax = minmax;
-		minmax = 0;
+	if ((sign - growlingbass->previous_sign) > 1.0f) {
+		growlingbass->nperiods += 1;
+		growlingbass->previous_minmax = growlingbass->minmax;
+		growlingbass->minmax = 0;
 	}
 	// Peak-hold the maximum magnitude of the current period for ceiling the
 	// odd harmonics generation in the next period.
-	if (fabsf(in)>minmax)
-		minmax=fabsf(in);
+	if (fabsf(in)>growlingbass->minmax)
+		growlingbass->minmax=fabsf(in);
 
 	// if we're on the positive, upper half of the signal
 	if (sign > 0.0f) {
 		// one period over two
-		if ((nperiods % 2) == 0)
+		if ((growlingbass->nperiods % 2) == 0)
 			shaped_sub = filtered_in; // outup this alternance
 		else
 			shaped_sub = -filtered_in; // or its negative counterpart
 	}
 
 	// Apply tone filter
-	float filtered_odd = biquad_step(&growlingbass.lpf_odd, shaped_odd);
-	float filtered_even = biquad_step(&growlingbass.lpf_even, shaped_even);
+	float filtered_odd = biquad_step(&growlingbass->lpf_odd, shaped_odd);
+	float filtered_even = biquad_step(&growlingbass->lpf_even, shaped_even);
 
-	previous_sign = sign;
+	growlingbass->previous_sign = sign;
 
 	// Apply output levels
-	return shaped_sub * growlingbass.level_sub + in
-		+ filtered_odd * growlingbass.level_odd + filtered_even * growlingbass.level_even;
+	return shaped_sub * smooth_step(&growlingbass->level_sub) + in
+		+ filtered_odd * smooth_step(&growlingbass->level_odd)
+		+ filtered_even * smooth_step(&growlingbass->level_even);
 }
+
+STEP_TO_BLOCK(growlingbass)
+DEFINE_EFFECT(growlingbass);
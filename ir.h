@@ -0,0 +1,174 @@
+//
+// Impulse responses for the convolver, with a cache next to each
+//
+//	FIR.raw		s32 samples like input.raw, of any length
+//	FIR.raw.cache	the head and the partition spectra that the
+//			convolver runs on
+//
+// The first time an IR is used, or after it changed (the cache has
+// the size and mtime of the file it was made from, and the partition
+// size), it gets converted and transformed and the cache written.
+// That goes to a temporary file that's then renamed into place, so
+// parallel runs never see half of one. After that, loading is just
+// an mmap of the cache that the convolver uses in place, so every
+// channel and every batch render of the same IR shares the pages.
+//
+// An IR that can't be cached (a read-only directory, say) is still
+// used, it just gets worked out every time. ir_load() never exits:
+// if there is no IR to use it says why and returns -1, and the effect
+// runs without it.
+//
+// Bump IR_MAGIC when the layout or the FFT changes, so that old
+// caches get redone.
+//
+#define IR_MAGIC "IRCACHE2"
+
+// 64 bytes, which keeps the spectra after it aligned
+struct ir_header {
+	char magic[8];
+	u32 len, B, parts, spare;
+	s64 size, mtime;	// of the IR, mtime in ns
+	u32 pad[6];
+};
+
+// Then convolver_prepared_size() bytes for the convolver
+static inline size_t ir_cache_size(int len, int B)
+{
+	return sizeof(struct ir_header) + convolver_prepared_size(len, B);
+}
+
+static inline s64 ir_mtime(const struct stat *st)
+{
+	return (s64) st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+// The cache if it's there and up to date for 'st' and 'B'
+static int ir_map_cache(struct convolver *c, const char *cache, const struct stat *st, int B)
+{
+	struct stat cst;
+	int fd = open(cache, O_RDONLY);
+
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &cst) || cst.st_size < sizeof(struct ir_header)) {
+		close(fd);
+		return -1;
+	}
+
+	void *map = mmap(NULL, cst.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -1;
+
+	const struct ir_header *h = map;
+	if (memcmp(h->magic, IR_MAGIC, 8) || h->B != B || h->size != st->st_size ||
+	    h->mtime != ir_mtime(st) || h->len != st->st_size / sizeof(s32) ||
+	    h->parts != convolver_parts(h->len, B) || cst.st_size != ir_cache_size(h->len, B) ||
+	    convolver_init_prepared(c, (const float *) (h + 1), h->parts, B)) {
+		munmap(map, cst.st_size);
+		return -1;
+	}
+	c->map = map;
+	c->map_size = cst.st_size;
+	return h->len;
+}
+
+static void ir_write_cache(const char *name, const char *cache, const struct ir_header *h,
+	const struct convolver *c)
+{
+	size_t prepared = convolver_prepared_size(h->len, h->B);
+	char tmp[PATH_MAX];
+	int fd;
+
+	fd = -1;
+	if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", cache) < sizeof(tmp))
+		fd = mkstemp(tmp);
+	if (fd < 0) {
+		fprintf(stderr, "%s: can't cache it (%s)\n", name, strerror(errno));
+		return;
+	}
+	fchmod(fd, 0644);
+	if (write(fd, h, sizeof(*h)) != sizeof(*h) ||
+	    write(fd, c->prepared, prepared) != prepared ||
+	    close(fd) || rename(tmp, cache)) {
+		fprintf(stderr, "%s: can't cache it (%s)\n", name, strerror(errno));
+		unlink(tmp);
+	}
+}
+
+// Read and convert the IR, and cache the result
+static int ir_build(struct convolver *c, const char *name, const char *cache, const struct stat *st, int B)
+{
+	struct ir_header h = { IR_MAGIC, .B = B, .size = st->st_size, .mtime = ir_mtime(st) };
+	int len = st->st_size / sizeof(s32);
+	int fd = open(name, O_RDONLY);
+
+	if (fd < 0) {
+		fprintf(stderr, "%s (running without it): %s\n", name, strerror(errno));
+		return -1;
+	}
+	s32 *raw = mmap(NULL, len * sizeof(s32), PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (raw == MAP_FAILED) {
+		fprintf(stderr, "%s (running without it): %s\n", name, strerror(errno));
+		return -1;
+	}
+
+	float *taps = malloc(len * sizeof(float));
+	if (!taps) {
+		fprintf(stderr, "%s (running without it): out of memory\n", name);
+		munmap(raw, len * sizeof(s32));
+		return -1;
+	}
+	for (int i = 0; i < len; i++)
+		taps[i] = raw[i] / 2147483648.0;
+	munmap(raw, len * sizeof(s32));
+
+	if (convolver_init(c, taps, len, B)) {
+		fprintf(stderr, "%s (running without it): out of memory\n", name);
+		free(taps);
+		return -1;
+	}
+	free(taps);
+	h.len = len;
+	h.parts = c->parts;
+	ir_write_cache(name, cache, &h, c);
+	return len;
+}
+
+// Set up 'c' with the IR in 'name' and partitions of 'B' samples.
+// Returns the number of taps, or -1 if there's no IR (after saying
+// why): 'c' is only set up when it returns more than zero
+static int ir_load(struct convolver *c, const char *name, int B)
+{
+	char cache[PATH_MAX];
+	struct stat st;
+	int len;
+
+	if (stat(name, &st)) {
+		fprintf(stderr, "%s (running without it): %s\n", name, strerror(errno));
+		return -1;
+	}
+	if (st.st_size < sizeof(s32)) {
+		fprintf(stderr, "%s (running without it): no samples in it\n", name);
+		return -1;
+	}
+	if (st.st_size / sizeof(s32) > INT_MAX / 2) {
+		fprintf(stderr, "%s (running without it): too long\n", name);
+		return -1;
+	}
+
+	if (st.st_size % sizeof(s32))
+		fprintf(stderr, "%s: ignoring the last %d bytes, it's s32 samples\n",
+			name, (int) (st.st_size % sizeof(s32)));
+
+	// With room for the temporary name
+	if (snprintf(cache, sizeof(cache), "%s.cache", name) >= sizeof(cache) - 7) {
+		fprintf(stderr, "%s (running without it): name too long\n", name);
+		return -1;
+	}
+	len = ir_map_cache(c, cache, &st, B);
+	if (len < 0)
+		len = ir_build(c, name, cache, &st, B);
+	return len;
+}
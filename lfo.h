@@ -13,7 +13,8 @@
 //
 // and a full cycle is four times that (ie the full 32-bit cycle).
 //
-// Calling that (2**32)/SAMPLES_PER_SEC "F_STEP", we get
+// Calling that (2**32)/SAMPLES_PER_SEC "F_STEP" (worked out
+// by set_sample_rate() in util.h), we get
 //
 //     T = F_STEP / lfo_step
 //     freq = lfo_step / F_STEP
@@ -21,7 +22,7 @@
 //     ms = 1000 * T = 1000 * F_STEP / lfo_step
 //             => lfo_step = 1000 * F_STEP / ms
 //
-#define F_STEP (TWO_POW_32/SAMPLES_PER_SEC)
+#define F_STEP (sample_rate.f_step)
 
 enum lfo_type {
 	lfo_sinewave,
@@ -54,37 +55,140 @@ void set_lfo_ms(struct lfo_state *lfo, float ms)
 	set_lfo_step(lfo, 1000 * F_STEP / ms);
 }
 
-float lfo_step(struct lfo_state *lfo, enum lfo_type type)
+// Skip ahead 'n' samples
+static inline void lfo_skip(struct lfo_state *lfo, u32 n)
 {
-	u32 now = lfo->idx;
-	u32 next = now + lfo->step;
+	lfo->idx += n * lfo->step;
+}
+
+//
+// The waveforms as functions of the phase. The quarter handling
+// is done with masks rather than branches, so that the block
+// versions below can be vectorized.
+//
+static inline float lfo_sawtooth_value(u32 now)
+{
+	return u32_to_fraction(now);
+}
+
+// Second and fourth quarter reverses direction
+static inline u32 lfo_quarter_phase(u32 now)
+{
+	u32 reverse = -((now >> 30) & 1);
+	return (now << 2) ^ reverse;
+}
+
+// Last two quarters are negative: flip the float sign bit
+static inline float lfo_quarter_sign(u32 now, float val)
+{
+	union { float f; u32 u; } v = { val };
+
+	v.u ^= now & 0x80000000;
+	return v.f;
+}
+
+static inline float lfo_triangle_value(u32 now)
+{
+	return lfo_quarter_sign(now, u32_to_fraction(lfo_quarter_phase(now)));
+}
+
+static inline float lfo_sinewave_value(u32 now)
+{
+	u32 phase = lfo_quarter_phase(now);
+#ifdef QUARTER_SINE_NEAREST
+	// Round the index: the end point is in the table too
+	u32 idx = ((phase >> (31-QUARTER_SINE_STEP_SHIFT)) + 1) >> 1;
 
-	lfo->idx = next;
+	return lfo_quarter_sign(now, quarter_sin[idx]);
+#else
+	u32 idx = phase >> (32-QUARTER_SINE_STEP_SHIFT);
+	float a = quarter_sin[idx];
+	float b = quarter_sin[idx+1];
 
-	if (type == lfo_sawtooth)
-		return u32_to_fraction(now);
+	phase <<= QUARTER_SINE_STEP_SHIFT;
+	return lfo_quarter_sign(now, a + (b-a)*u32_to_fraction(phase));
+#endif
+}
 
-	float val;
-	u32 quarter = now >> 30;
-	now <<= 2;
+static inline float lfo_value(u32 now, enum lfo_type type)
+{
+	switch (type) {
+	case lfo_sawtooth:
+		return lfo_sawtooth_value(now);
+	case lfo_triangle:
+		return lfo_triangle_value(now);
+	default:
+		return lfo_sinewave_value(now);
+	}
+}
 
-	// Second and fourth quarter reverses direction
-	if (quarter & 1)
-		now = ~now;
+float lfo_step(struct lfo_state *lfo, enum lfo_type type)
+{
+	u32 now = lfo->idx;
 
-	if (type == lfo_sinewave) {
-		u32 idx = now >> (32-QUARTER_SINE_STEP_SHIFT);
-		float a = quarter_sin[idx];
-		float b = quarter_sin[idx+1];
+	lfo->idx = now + lfo->step;
+	return lfo_value(now, type);
+}
 
-		now <<= QUARTER_SINE_STEP_SHIFT;
-		val = a + (b-a)*u32_to_fraction(now);
-	} else {
-		val = u32_to_fraction(now);
+//
+// The next 'n' values of the LFO at once, the same as 'n'
+// calls to lfo_step(). Every phase is computed from the
+// starting one, so there's no dependency between samples.
+//
+// The _fm versions take a new lfo step for every sample, as if
+// each lfo_step() had been preceded by a set_lfo_step().
+//
+#define LFO_FILL(name)							\
+static inline void name##_fill(const struct lfo_state *lfo, float *out, int n) \
+{									\
+	u32 idx = lfo->idx, step = lfo->step;				\
+	for (int i = 0; i < n; i++)					\
+		out[i] = name##_value(idx + i*step);			\
+}									\
+static inline void name##_fill_fm(struct lfo_state *lfo, const float *step, float *out, int n) \
+{									\
+	u32 idx = lfo->idx, s = lfo->step;				\
+	for (int i = 0; i < n; i++) {					\
+		s = (u32) rintf(step[i]);				\
+		out[i] = name##_value(idx);				\
+		idx += s;						\
+	}								\
+	lfo->idx = idx;							\
+	lfo->step = s;							\
+}
+
+LFO_FILL(lfo_sawtooth)
+LFO_FILL(lfo_triangle)
+LFO_FILL(lfo_sinewave)
+
+static inline void lfo_fill(struct lfo_state *lfo, enum lfo_type type, float *out, int n)
+{
+	switch (type) {
+	case lfo_sawtooth:
+		lfo_sawtooth_fill(lfo, out, n);
+		break;
+	case lfo_triangle:
+		lfo_triangle_fill(lfo, out, n);
+		break;
+	default:
+		lfo_sinewave_fill(lfo, out, n);
+		break;
 	}
+	lfo_skip(lfo, n);
+}
 
-	// Last two quarters are negative
-	if (quarter & 2)
-		val = -val;
-	return val;
+static inline void lfo_fill_fm(struct lfo_state *lfo, enum lfo_type type,
+	const float *step, float *out, int n)
+{
+	switch (type) {
+	case lfo_sawtooth:
+		lfo_sawtooth_fill_fm(lfo, step, out, n);
+		break;
+	case lfo_triangle:
+		lfo_triangle_fill_fm(lfo, step, out, n);
+		break;
+	default:
+		lfo_sinewave_fill_fm(lfo, step, out, n);
+		break;
+	}
 }
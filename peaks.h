@@ -0,0 +1,152 @@
+//
+// Min/max peak pyramids for visualize.py
+//
+// The sidecar "<file>.peaks" has the minimum and the maximum of every
+// 2^PEAKS_SHIFT frames of the file, then of every 2^(PEAKS_SHIFT+1)
+// frames and so on, until one bin covers the whole file. A zoomed-out
+// view can then map the level that has about as many bins as it has
+// points to plot, and still see every peak exactly.
+//
+// All little-endian 32-bit words:
+//
+//	magic ("PKS1"), version (1), channels, shift, levels, 0,
+//	frames (low word, high word),
+//
+// followed by the levels in order, each one a min, max pair for every
+// channel of every bin. Level 'k' has ceil(frames / 2^(shift+k)) bins,
+// the last one possibly covering less.
+//
+// Only the first level is collected while rendering, the rest are
+// worked out from it when the file is written.
+//
+#define PEAKS_SHIFT 8
+#define PEAKS_MAGIC 0x31534b50
+#define PEAKS_VERSION 1
+
+struct peaks {
+	const char *name;
+	int channels;
+	u64 frames;
+
+	// Level 0, including the bin that is being filled
+	s32 *bins;
+	size_t alloc;
+};
+
+static struct peaks *peaks_new(const char *name, int channels)
+{
+	struct peaks *p = calloc(1, sizeof(*p));
+	char *pname = malloc(strlen(name) + 7);
+
+	if (!p || !pname) {
+		perror("malloc");
+		exit(1);
+	}
+	sprintf(pname, "%s.peaks", name);
+	p->name = pname;
+	p->channels = channels;
+	return p;
+}
+
+// 'n' interleaved frames
+static void peaks_add(struct peaks *p, const s32 *x, int n)
+{
+	const u64 mask = (1 << PEAKS_SHIFT) - 1;
+	int channels = p->channels;
+
+	for (int i = 0; i < n; i++, p->frames++) {
+		size_t bin = p->frames >> PEAKS_SHIFT;
+		s32 *mm = p->bins + 2 * bin * channels;
+
+		if (!(p->frames & mask)) {
+			if (bin == p->alloc) {
+				p->alloc = p->alloc ? 2 * p->alloc : 1024;
+				p->bins = realloc(p->bins, p->alloc * channels * 2 * sizeof(s32));
+				if (!p->bins) {
+					perror("realloc");
+					exit(1);
+				}
+				mm = p->bins + 2 * bin * channels;
+			}
+			for (int ch = 0; ch < channels; ch++)
+				mm[2*ch] = mm[2*ch+1] = x[i*channels + ch];
+			continue;
+		}
+
+		for (int ch = 0; ch < channels; ch++) {
+			s32 val = x[i*channels + ch];
+
+			if (val < mm[2*ch])
+				mm[2*ch] = val;
+			if (val > mm[2*ch+1])
+				mm[2*ch+1] = val;
+		}
+	}
+}
+
+static void peaks_write_level(FILE *f, struct peaks *p, const s32 *bins, size_t nr)
+{
+	if (fwrite(bins, 2 * p->channels * sizeof(s32), nr, f) != nr) {
+		perror(p->name);
+		exit(1);
+	}
+}
+
+// Write out the file, and free everything
+static void peaks_close(struct peaks *p)
+{
+	int words = 2 * p->channels;
+	size_t nr = (p->frames + (1 << PEAKS_SHIFT) - 1) >> PEAKS_SHIFT;
+	u32 levels = 0;
+	FILE *f;
+
+	for (size_t bins = nr; bins; bins = bins > 1 ? (bins + 1) / 2 : 0)
+		levels++;
+
+	f = fopen(p->name, "wb");
+	if (!f) {
+		perror(p->name);
+		exit(1);
+	}
+
+	u32 header[8] = {
+		PEAKS_MAGIC, PEAKS_VERSION, p->channels, PEAKS_SHIFT, levels, 0,
+		(u32) p->frames, (u32) (p->frames >> 32)
+	};
+	if (fwrite(header, sizeof(header), 1, f) != 1) {
+		perror(p->name);
+		exit(1);
+	}
+
+	// Each level in place over the one below it
+	for (u32 level = 0; level < levels; level++) {
+		peaks_write_level(f, p, p->bins, nr);
+
+		size_t next = (nr + 1) / 2;
+		for (size_t b = 0; b < next; b++) {
+			const s32 *a = p->bins + 2*b * words;
+			s32 *dst = p->bins + b * words;
+
+			for (int w = 0; w < words; w++) {
+				s32 val = a[w];
+
+				// A pair, unless it's an odd one at the end
+				if (2*b+1 < nr) {
+					s32 other = a[words + w];
+					if (w & 1 ? other > val : other < val)
+						val = other;
+				}
+				dst[w] = val;
+			}
+		}
+		nr = next;
+	}
+
+	if (fclose(f)) {
+		perror(p->name);
+		exit(1);
+	}
+	free(p->bins);
+	free((char *) p->name);
+	free(p);
+}
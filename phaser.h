@@ -1,9 +1,25 @@
-struct {
+//
+// The allpass coefficients only get recomputed every
+// PHASER_SWEEP_INTERVAL samples and are interpolated in
+// between (or held, with PHASER_SWEEP_HOLD).
+//
+#ifndef PHASER_SWEEP_INTERVAL
+  #define PHASER_SWEEP_INTERVAL 16
+#endif
+#ifndef PHASER_SWEEP_HOLD
+  #define PHASER_SWEEP_HOLD 0
+#endif
+
+struct phaser_state {
 	struct lfo_state lfo;
-	struct biquad_coeff coeff;
+	struct biquad_sweep sweep;
 	float s0[2], s1[2], s2[2], s3[2];
 	float center_f, octaves, Q, feedback;
-} phaser;
+#ifdef FIXED_POINT
+	struct biquad_q30 q[2];
+	s32 q0[2], q1[2], q2[2], q3[2];
+#endif
+};
 
 void phaser_describe(float pot[4])
 {
@@ -22,29 +38,147 @@ void phaser_describe(float pot[4])
 	fprintf(stderr, " Q=%g\n", Q);
 }
 
-void phaser_init(float pot[4])
+void phaser_init(struct phaser_state *phaser, float pot[4])
 {
 	float ms = cubic(pot[0], 25, 2000);		// 25ms .. 2s
-	set_lfo_ms(&phaser.lfo, ms);
-	phaser.feedback = linear(pot[1], 0, 0.75);
+	set_lfo_ms(&phaser->lfo, ms);
+	phaser->feedback = linear(pot[1], 0, 0.75);
+
+	phaser->center_f = pot_frequency(pot[2]);		// 220Hz .. 6.5kHz
+	phaser->octaves = 0.5;				// 155Hz .. 9kHz
+	phaser->Q = linear(pot[3], 0.25, 2);
+
+	if (phaser->sweep.interval != PHASER_SWEEP_INTERVAL)
+		biquad_sweep_init(&phaser->sweep, PHASER_SWEEP_INTERVAL, PHASER_SWEEP_HOLD);
+}
 
-	phaser.center_f = pot_frequency(pot[2]);		// 220Hz .. 6.5kHz
-	phaser.octaves = 0.5;				// 155Hz .. 9kHz
-	phaser.Q = linear(pot[3], 0.25, 2);
+// Aim for where the LFO will be at the end of the interval
+static inline void phaser_sweep(struct phaser_state *phaser)
+{
+	struct biquad_coeff target;
+
+	lfo_skip(&phaser->lfo, phaser->sweep.interval - 1);
+	float lfo = lfo_step(&phaser->lfo, lfo_triangle);
+	float freq = pow2(lfo*phaser->octaves) * phaser->center_f;
+
+	_biquad_allpass_filter(&target, freq, phaser->Q);
+	biquad_sweep_target(&phaser->sweep, &target);
 }
 
-float phaser_step(float in)
+static inline float phaser_step(struct phaser_state *phaser, float in)
 {
-	float lfo = lfo_step(&phaser.lfo, lfo_triangle);
-	float freq = pow2(lfo*phaser.octaves) * phaser.center_f;
+	struct biquad_coeff *c;
 	float out;
 
-	_biquad_allpass_filter(&phaser.coeff, freq, phaser.Q);
+	if (biquad_sweep_due(&phaser->sweep))
+		phaser_sweep(phaser);
+	c = biquad_sweep_step(&phaser->sweep);
 
-	out = in + phaser.feedback * phaser.s3[0];
-	out = biquad_step_df1(&phaser.coeff, out, phaser.s0, phaser.s1);
-	out = biquad_step_df1(&phaser.coeff, out, phaser.s1, phaser.s2);
-	out = biquad_step_df1(&phaser.coeff, out, phaser.s2, phaser.s3);
+	out = in + phaser->feedback * phaser->s3[0];
+	out = biquad_step_df1(c, out, phaser->s0, phaser->s1);
+	out = biquad_step_df1(c, out, phaser->s1, phaser->s2);
+	out = biquad_step_df1(c, out, phaser->s2, phaser->s3);
 
 	return limit_value(in + out);
 }
+
+STEP_TO_BLOCK(phaser)
+
+#ifdef FIXED_POINT
+// The allpass chain runs on Q2.29 for feedback headroom
+static void phaser_fixed(struct phaser_state *phaser, const q31 *in, q31 *out, int n)
+{
+	q31 feedback = float_to_q31(phaser->feedback);
+
+	for (int i = 0; i < n; i++) {
+		struct biquad_q30 *c;
+		s32 val;
+
+		if (biquad_sweep_due(&phaser->sweep)) {
+			phaser_sweep(phaser);
+			biquad_q30_sweep_start(&phaser->sweep, phaser->q);
+		}
+		c = biquad_q30_sweep_step(&phaser->sweep, phaser->q);
+
+		val = q31_sat((s64) (in[i] >> FIXED_HEADROOM) + q31_mul(feedback, phaser->q3[0]));
+		val = biquad_q30_step_df1(c, val, phaser->q0, phaser->q1);
+		val = biquad_q30_step_df1(c, val, phaser->q1, phaser->q2);
+		val = biquad_q30_step_df1(c, val, phaser->q2, phaser->q3);
+
+		out[i] = q31_limit((s64) in[i] + ((s64) val << FIXED_HEADROOM));
+	}
+}
+#endif
+
+//
+// Up to BIQUAD_LANES channels side by side, one biquad lane each.
+// The allpass state and the coefficient ramps live lane by lane for
+// the duration of the block. Each channel still works out its own
+// sweep targets, since their LFOs can be spread apart.
+//
+static void phaser_lanes(struct phaser_state **ph, float **buf, int channels, int n)
+{
+	struct biquad_lanes c = { 0 };
+	float s[4][2][BIQUAD_LANES] = { 0 };
+	float feedback[BIQUAD_LANES] = { 0 };
+	float in[BIQUAD_LANES] = { 0 }, val[BIQUAD_LANES];
+
+	for (int ch = 0; ch < channels; ch++) {
+		struct phaser_state *p = ph[ch];
+		float *state[4] = { p->s0, p->s1, p->s2, p->s3 };
+
+		for (int k = 0; k < 4; k++) {
+			s[k][0][ch] = state[k][0];
+			s[k][1][ch] = state[k][1];
+		}
+		feedback[ch] = p->feedback;
+		biquad_lanes_load(&c, ch, &p->sweep);
+	}
+
+	for (int i = 0; i < n; i++) {
+		for (int ch = 0; ch < channels; ch++) {
+			struct phaser_state *p = ph[ch];
+
+			if (biquad_sweep_due(&p->sweep)) {
+				phaser_sweep(p);
+				biquad_lanes_load(&c, ch, &p->sweep);
+			}
+			p->sweep.count--;
+			in[ch] = buf[ch][i];
+		}
+		biquad_lanes_advance(&c);
+
+		for (int l = 0; l < BIQUAD_LANES; l++)
+			val[l] = in[l] + feedback[l] * s[3][0][l];
+		biquad_lanes_step_df1(&c.coeff, val, s[0], s[1]);
+		biquad_lanes_step_df1(&c.coeff, val, s[1], s[2]);
+		biquad_lanes_step_df1(&c.coeff, val, s[2], s[3]);
+
+		for (int ch = 0; ch < channels; ch++)
+			buf[ch][i] = limit_value(in[ch] + val[ch]);
+	}
+
+	for (int ch = 0; ch < channels; ch++) {
+		struct phaser_state *p = ph[ch];
+		float *state[4] = { p->s0, p->s1, p->s2, p->s3 };
+
+		for (int k = 0; k < 4; k++) {
+			state[k][0] = s[k][0][ch];
+			state[k][1] = s[k][1][ch];
+		}
+		biquad_lane_get(&c.coeff, ch, &p->sweep.coeff);
+	}
+}
+
+static void phaser_multi(void **states, float **buf, int channels, int n)
+{
+	for (int ch = 0; ch < channels; ch += BIQUAD_LANES) {
+		int lanes = channels - ch;
+		if (lanes > BIQUAD_LANES)
+			lanes = BIQUAD_LANES;
+		phaser_lanes((struct phaser_state **) states + ch, buf + ch, lanes, n);
+	}
+}
+
+EFFECT_LFO(phaser, lfo)
+DEFINE_FIXED_EFFECT(phaser, .multi = phaser_multi, .lfo = phaser_lfo_fn);
@@ -2,57 +2,119 @@
 // Do the 'sample to float' and 'float to sample' processing
 // together with basic noise gating
 //
+// The gate state is per input stream, so that several renders
+// can run at the same time (see the batch mode in convert).
+//
+struct process_state {
+	int max, min;
+	unsigned int magnitude;
+	float noise_gate;
+#ifdef FIXED_POINT
+	q31 noise_gate_q31;
+#endif
+};
 
-static unsigned int magnitude;
+// The last magnitude this thread saw, for the 'magnitude' effect
+static _Thread_local unsigned int magnitude;
 
 #define SAMPLE_TO_FLOAT_MULTIPLIER (1.0 / 0x80000000)
 #define FLOAT_TO_SAMPLE_MULTIPLIER (0x80000000 / 1.0)
 
-static inline float process_input(s32 sample)
+static inline void process_init(struct process_state *ps)
 {
-	static int max, min;
-	const float max_gate = SAMPLE_TO_FLOAT_MULTIPLIER;
-	const float min_gate = max_gate / 100;
-	static float noise_gate = SAMPLE_TO_FLOAT_MULTIPLIER / 100;
+	ps->max = ps->min = 0;
+	ps->noise_gate = SAMPLE_TO_FLOAT_MULTIPLIER / 100;
+#ifdef FIXED_POINT
+	ps->noise_gate_q31 = Q31(0.01);
+#endif
+}
 
+//
+// Track the signal magnitude (also used on its own
+// for the analysis taps in convert)
+//
+static inline unsigned int process_track(struct process_state *ps, s32 sample)
+{
 	//
 	// We'll track max and min rather than
 	// the maximum absolute value, in case
 	// the input is unbalanced
 	//
-	if (sample > max)
-		max = sample;
-	if (sample < min)
-		min = sample;
-	magnitude = max - min;
+	if (sample > ps->max)
+		ps->max = sample;
+	if (sample < ps->min)
+		ps->min = sample;
+	ps->magnitude = ps->max - ps->min;
 
 	//
-	// This is sample-rate dependent, but
-	// we don't really care. This results in
-	// a half-life of roughly 3ksamples or
-	// roughly 60ms at 48kHz sample rate.
+	// This results in a half-life of roughly
+	// 3ksamples or roughly 60ms at 48kHz sample
+	// rate, and the shift gets adjusted to keep
+	// it about that at other rates.
 	//
-	max -= (max >> 12)+1;
-	min -= (min >> 12)-1;
+	int shift = sample_rate.envelope_shift;
+	ps->max -= (ps->max >> shift)+1;
+	ps->min -= (ps->min >> shift)-1;
+	return ps->magnitude;
+}
+
+//
+// Track the magnitude, and return whether the
+// noise gate should be opening or closing
+//
+static inline int process_gate(struct process_state *ps, s32 sample)
+{
+	magnitude = process_track(ps, sample);
 
 	//
 	// Random fixed noise-gate looking at the
 	// top 10 bits of the signal magnitude (which
 	// is approx 1mVrms per step)
 	//
-	if (magnitude >> 22) {
-		noise_gate *= 1.001;
+	return magnitude >> 22;
+}
+
+static inline float process_input(struct process_state *ps, s32 sample)
+{
+	const float max_gate = SAMPLE_TO_FLOAT_MULTIPLIER;
+	const float min_gate = max_gate / 100;
+	float noise_gate = ps->noise_gate;
+
+	if (process_gate(ps, sample)) {
+		noise_gate *= sample_rate.gate_up;
 		if (noise_gate > max_gate)
 			noise_gate = max_gate;
 	} else {
-		noise_gate *= 0.999;
+		noise_gate *= sample_rate.gate_down;
 		if (noise_gate < min_gate)
 			noise_gate = min_gate;
 	}
+	ps->noise_gate = noise_gate;
 
 	return sample * noise_gate;
 }
 
+#ifdef FIXED_POINT
+// The same with a Q31 gate, and the result stays Q31
+static inline q31 process_input_q31(struct process_state *ps, s32 sample)
+{
+	const q31 min_gate = Q31(0.01);
+	q31 noise_gate = ps->noise_gate_q31;
+
+	if (process_gate(ps, sample)) {
+		// Saturates at a gain of one
+		noise_gate = q31_sat((s64) noise_gate + q31_mul(noise_gate, sample_rate.gate_step_q31));
+	} else {
+		noise_gate -= q31_mul(noise_gate, sample_rate.gate_step_q31);
+		if (noise_gate < min_gate)
+			noise_gate = min_gate;
+	}
+	ps->noise_gate_q31 = noise_gate;
+
+	return q31_mul(sample, noise_gate);
+}
+#endif
+
 static inline s32 process_output(float out)
 {
 	s32 sample = (int)(out * FLOAT_TO_SAMPLE_MULTIPLIER);
@@ -0,0 +1,56 @@
+//
+// Single-producer, single-consumer queue of parameter events
+//
+// The control thread pushes, the audio loop pops, and neither ever
+// waits for the other: the only shared state is the two indexes,
+// each written by just one side. The producer publishes an event by
+// moving 'head' with release ordering after filling the slot in,
+// and the consumer frees the slot by moving 'tail' the same way.
+//
+// Every event has the sample time it should take effect at,
+// counted in samples since the start (and allowed to wrap).
+//
+#include <stdatomic.h>
+
+#define PARAM_QUEUE_SIZE 256	// power of two
+
+struct param_event {
+	u32 time;
+	unsigned short idx;	// pot index across the whole chain
+	float value;
+};
+
+struct param_queue {
+	atomic_uint head, tail;
+	struct param_event event[PARAM_QUEUE_SIZE];
+};
+
+// Returns zero if the queue is full
+static inline int param_queue_push(struct param_queue *q, const struct param_event *ev)
+{
+	unsigned int head = atomic_load_explicit(&q->head, memory_order_relaxed);
+	unsigned int tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+
+	if (head - tail >= PARAM_QUEUE_SIZE)
+		return 0;
+	q->event[head & (PARAM_QUEUE_SIZE-1)] = *ev;
+	atomic_store_explicit(&q->head, head+1, memory_order_release);
+	return 1;
+}
+
+// The oldest event without removing it, or NULL if there is none
+static inline const struct param_event *param_queue_peek(struct param_queue *q)
+{
+	unsigned int tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+	unsigned int head = atomic_load_explicit(&q->head, memory_order_acquire);
+
+	if (head == tail)
+		return NULL;
+	return q->event + (tail & (PARAM_QUEUE_SIZE-1));
+}
+
+static inline void param_queue_pop(struct param_queue *q)
+{
+	unsigned int tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+	atomic_store_explicit(&q->tail, tail+1, memory_order_release);
+}
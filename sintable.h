@@ -0,0 +1,69 @@
+//
+// The quarter sine table behind fastsincos() and the LFO sinewave
+//
+// QUARTER_SINE_STEPS steps from sin(0) to sin(pi/2), plus the end
+// point so that there's always a next entry to interpolate to. The
+// compiler works the entries out from a Taylor series in long double
+// (good to 1e-13 over the quarter), so there's no generator to run
+// and the resolution is just a build flag:
+//
+//	-DQUARTER_SINE_STEP_SHIFT=N	2**N steps, N = 4 .. 12, default 8
+//	-DQUARTER_SINE_NEAREST		use the nearest entry instead of
+//					interpolating between two
+//
+// Interpolated, the error is about (pi/2 / steps)**2 / 8: 7.5e-5
+// with 64 steps (260 bytes, for the RP2354 SRAM), 4.7e-6 with the
+// default 256 and 1.8e-8 with 4096. The nearest entry is up to half
+// a step off, 1.9e-4 even with 4096 steps (16kB), but that's one
+// load and no multiply.
+//
+// 'make bench-sine' shows what each costs, and tests/lfo checks
+// every phase of whichever one it's built with.
+//
+#ifndef QUARTER_SINE_STEP_SHIFT
+#define QUARTER_SINE_STEP_SHIFT 8
+#endif
+
+#if QUARTER_SINE_STEP_SHIFT < 4 || QUARTER_SINE_STEP_SHIFT > 12
+#error "QUARTER_SINE_STEP_SHIFT has to be 4 .. 12"
+#endif
+
+#define QUARTER_SINE_STEPS (1 << QUARTER_SINE_STEP_SHIFT)
+
+// sin(x) for 0 <= x <= pi/2, Horner in x**2 up to the x**17 term
+#define _QSIN(x, x2) ((x) * (1 - (x2)/6 * (1 - (x2)/20 * (1 - (x2)/42 * (1 - (x2)/72 * \
+	(1 - (x2)/110 * (1 - (x2)/156 * (1 - (x2)/210 * (1 - (x2)/272)))))))))
+
+#define _QSIN_X(i) ((i) * (1.570796326794896619231321691639751442L / QUARTER_SINE_STEPS))
+#define _QSIN_1(i) (float) _QSIN(_QSIN_X(i), _QSIN_X(i) * _QSIN_X(i)),
+#define _QSIN_2(i) _QSIN_1(i) _QSIN_1((i)+1)
+#define _QSIN_4(i) _QSIN_2(i) _QSIN_2((i)+2)
+#define _QSIN_8(i) _QSIN_4(i) _QSIN_4((i)+4)
+#define _QSIN_16(i) _QSIN_8(i) _QSIN_8((i)+8)
+#define _QSIN_32(i) _QSIN_16(i) _QSIN_16((i)+16)
+#define _QSIN_64(i) _QSIN_32(i) _QSIN_32((i)+32)
+#define _QSIN_128(i) _QSIN_64(i) _QSIN_64((i)+64)
+#define _QSIN_256(i) _QSIN_128(i) _QSIN_128((i)+128)
+#define _QSIN_512(i) _QSIN_256(i) _QSIN_256((i)+256)
+#define _QSIN_1024(i) _QSIN_512(i) _QSIN_512((i)+512)
+#define _QSIN_2048(i) _QSIN_1024(i) _QSIN_1024((i)+1024)
+#define _QSIN_4096(i) _QSIN_2048(i) _QSIN_2048((i)+2048)
+
+#define _QSIN_SHIFT_4 _QSIN_16
+#define _QSIN_SHIFT_5 _QSIN_32
+#define _QSIN_SHIFT_6 _QSIN_64
+#define _QSIN_SHIFT_7 _QSIN_128
+#define _QSIN_SHIFT_8 _QSIN_256
+#define _QSIN_SHIFT_9 _QSIN_512
+#define _QSIN_SHIFT_10 _QSIN_1024
+#define _QSIN_SHIFT_11 _QSIN_2048
+#define _QSIN_SHIFT_12 _QSIN_4096
+
+// Expand the shift before pasting it
+#define _QSIN_TABLE(shift) _QSIN_SHIFT(shift)
+#define _QSIN_SHIFT(shift) _QSIN_SHIFT_##shift(0)
+
+static const float quarter_sin[QUARTER_SINE_STEPS + 1] = {
+	_QSIN_TABLE(QUARTER_SINE_STEP_SHIFT)
+	1
+};
@@ -0,0 +1,194 @@
+//
+// Streaming spectrogram of the output
+//
+//	convert growlingbass input.raw output.raw --stft=output.stft [--window=2048] [--hop=512] [--stft-float]
+//
+// Every 'hop' samples the last 'window' samples of each channel get a
+// Hann window and an FFT (fft.h), and the log-magnitude of the bins
+// 0 .. window/2 is appended to the file. A full-scale sine comes out
+// at about 0 dB.
+//
+// The file is a header of eight little-endian 32-bit words
+//
+//	magic ("STF1"), version (1), window, hop, bins, format, channels, rate
+//
+// followed by the frames, each one 'bins' values for every channel.
+// Format 0 is 16-bit unsigned, in 1/256 dB above STFT_FLOOR dB (so
+// zero is anything at or below the floor), and format 1 is float dB.
+// Frame 't' covers the samples from t*hop to t*hop+window-1, and the
+// first window-hop samples of the first frame are zeroes.
+//
+#define STFT_MAGIC 0x31465453
+#define STFT_VERSION 1
+#define STFT_FLOOR -200
+
+static const char *stft_name;
+static int stft_window = 2048, stft_hop, stft_float;
+
+struct stft {
+	struct fft fft;
+	int fd, channels, bins, fill;
+	float *window;		// The Hann window, with the scaling
+	float *history;		// 'window' samples of each channel
+	float *spectrum;	// FFT scratch
+	void *frame;		// One output frame
+};
+
+// Parse the STFT options, returns non-zero if it was one
+static int stft_option(const char *arg)
+{
+	if (!strncmp(arg, "--stft=", 7)) {
+		stft_name = arg+7;
+		return 1;
+	}
+	if (!strncmp(arg, "--window=", 9)) {
+		stft_window = atoi(arg+9);
+		return 1;
+	}
+	if (!strncmp(arg, "--hop=", 6)) {
+		stft_hop = atoi(arg+6);
+		return 1;
+	}
+	if (!strcmp(arg, "--stft-float")) {
+		stft_float = 1;
+		return 1;
+	}
+	return 0;
+}
+
+static struct stft *stft_open(int channels)
+{
+	struct stft *s;
+	int n = stft_window;
+
+	if (!stft_name)
+		return NULL;
+	if (!stft_hop)
+		stft_hop = n / 4;
+	if (n < 16 || (n & (n-1)) || stft_hop < 1 || stft_hop > n) {
+		fprintf(stderr, "Bad STFT window %d (a power of two) or hop %d\n", n, stft_hop);
+		exit(1);
+	}
+
+	s = calloc(1, sizeof(*s));
+	if (!s || fft_init(&s->fft, n)) {
+		perror("calloc");
+		exit(1);
+	}
+	s->channels = channels;
+	s->bins = n/2 + 1;
+	s->fill = n - stft_hop;
+	s->window = malloc(n * sizeof(float));
+	s->history = calloc(n * channels, sizeof(float));
+	s->spectrum = malloc(n * sizeof(float));
+	s->frame = malloc(s->bins * channels * (stft_float ? sizeof(float) : sizeof(u16)));
+	if (!s->window || !s->history || !s->spectrum || !s->frame) {
+		perror("malloc");
+		exit(1);
+	}
+
+	// The coherent gain of the Hann window is 1/2, and a sine
+	// of amplitude 1 gives a bin of n/2 before that
+	for (int i = 0; i < n; i++)
+		s->window[i] = (float) ((1 - cos(2*M_PI*i/n)) / 2 * 4 / n);
+
+	s->fd = open(stft_name, O_CREAT | O_WRONLY | O_TRUNC, 0666);
+	if (s->fd < 0) {
+		perror(stft_name);
+		exit(1);
+	}
+
+	u32 header[8] = {
+		STFT_MAGIC, STFT_VERSION, n, stft_hop, s->bins, stft_float, channels,
+		(u32) SAMPLES_PER_SEC
+	};
+	if (write(s->fd, header, sizeof(header)) != sizeof(header)) {
+		perror(stft_name);
+		exit(1);
+	}
+	return s;
+}
+
+// Power to dB is 10*log10(x) = 10*log10(2)*log2(x)
+#define STFT_DB_PER_LOG2 3.0103f
+
+static void stft_frame(struct stft *s)
+{
+	int n = stft_window, bins = s->bins;
+
+	for (int ch = 0; ch < s->channels; ch++) {
+		const float *x = s->history + ch*n;
+		float *z = s->spectrum;
+
+		for (int i = 0; i < n; i++)
+			z[i] = x[i] * s->window[i];
+		fft_forward(&s->fft, z, z);
+
+		// Packed: bin 0 and bin n/2 share the first pair
+		for (int k = 0; k < bins; k++) {
+			float re = k == 0 ? z[0] : k == n/2 ? z[1] : z[2*k];
+			float im = k == 0 || k == n/2 ? 0 : z[2*k+1];
+			float power = re*re + im*im;
+			float db = power > 1e-30f ? STFT_DB_PER_LOG2 * fast_log2(power) : STFT_FLOOR;
+
+			if (stft_float) {
+				((float *) s->frame)[ch*bins + k] = db;
+				continue;
+			}
+
+			float v = (db - STFT_FLOOR) * 256;
+			if (v < 0)
+				v = 0;
+			if (v > 65535)
+				v = 65535;
+			((u16 *) s->frame)[ch*bins + k] = (u16) v;
+		}
+	}
+
+	size_t size = bins * s->channels * (stft_float ? sizeof(float) : sizeof(u16));
+	if (write(s->fd, s->frame, size) != size) {
+		perror(stft_name);
+		exit(1);
+	}
+}
+
+// 'n' interleaved frames of output
+static void stft_add(struct stft *s, const s32 *x, int n)
+{
+	int channels = s->channels, len = stft_window;
+
+	while (n > 0) {
+		int now = len - s->fill;
+		if (now > n)
+			now = n;
+
+		for (int ch = 0; ch < channels; ch++) {
+			float *h = s->history + ch*len + s->fill;
+			for (int i = 0; i < now; i++)
+				h[i] = x[i*channels + ch] * (float) SAMPLE_TO_FLOAT_MULTIPLIER;
+		}
+		x += now * channels;
+		n -= now;
+		s->fill += now;
+
+		if (s->fill == len) {
+			stft_frame(s);
+			for (int ch = 0; ch < channels; ch++) {
+				float *h = s->history + ch*len;
+				memmove(h, h + stft_hop, (len - stft_hop) * sizeof(float));
+			}
+			s->fill = len - stft_hop;
+		}
+	}
+}
+
+static void stft_close(struct stft *s)
+{
+	close(s->fd);
+	fft_free(&s->fft);
+	free(s->window);
+	free(s->history);
+	free(s->spectrum);
+	free(s->frame);
+	free(s);
+}
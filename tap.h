@@ -0,0 +1,262 @@
+//
+// Analysis taps: side-streams written during the main render
+//
+//	convert echo input.raw output.raw --tap=in:magnitude.raw --tap=out:outmagnitude.raw
+//
+// Every tap is a file of s32 samples (interleaved like the audio with
+// more than one channel) that lines up with the output, so they can
+// all go into visualize.py together. The kinds are:
+//
+//	in	the input envelope, as seen by the noise gate (what the
+//		'magnitude' effect used to be run on input.raw for)
+//	out	the same envelope tracking on the output
+//	gate	the noise gate gain, full scale meaning no attenuation
+//	peak	the peak absolute output of each block, held over the block
+//	rms	the RMS output of each block, held over the block
+//	stageN	the signal after the first N effects of the chain
+//
+// The blocks are the ones the render runs, ie at most BLOCKSIZE
+// samples but split wherever a pot changes.
+//
+// With --peaks every tap file, and the input and output files, also
+// get a "<file>.peaks" min/max pyramid (see peaks.h). The spectrogram
+// of the output (see stft.h) is done here as well.
+//
+// Taps are only written by the normal file (or pipe) render.
+//
+#define TAP_FRAMES 8192
+
+enum tap_kind { TAP_IN, TAP_OUT, TAP_GATE, TAP_PEAK, TAP_RMS, TAP_STAGE };
+
+static const char *const tap_names[] = {
+	[TAP_IN] = "in",
+	[TAP_OUT] = "out",
+	[TAP_GATE] = "gate",
+	[TAP_PEAK] = "peak",
+	[TAP_RMS] = "rms",
+	[TAP_STAGE] = "stage",
+};
+
+struct tap {
+	enum tap_kind kind;
+	int stage;
+	const char *name;
+	int fd;
+
+	// The buffered frames, and the ones of the current block
+	// start at 'pos'
+	s32 *buf;
+	int pos;
+
+	// The output envelope keeps its own tracking
+	struct process_state env[MAX_CHANNELS];
+
+	struct peaks *peaks;
+};
+
+static int tap_peaks;
+
+// "kind:file", returns non-zero if it was one
+static int tap_option(struct render *r, const char *arg)
+{
+	struct tap *t;
+	const char *name;
+
+	if (!strcmp(arg, "--peaks")) {
+		tap_peaks = 1;
+		return 1;
+	}
+	if (strncmp(arg, "--tap=", 6))
+		return 0;
+	arg += 6;
+	name = strchr(arg, ':');
+	if (!name) {
+		fprintf(stderr, "Bad tap '%s'\n", arg);
+		exit(1);
+	}
+
+	r->taps = realloc(r->taps, (r->nr_taps+1) * sizeof(*r->taps));
+	if (!r->taps) {
+		perror("realloc");
+		exit(1);
+	}
+	t = r->taps + r->nr_taps++;
+	memset(t, 0, sizeof(*t));
+	t->name = name+1;
+	for (int k = 0; k < ARRAY_SIZE(tap_names); k++) {
+		int len = strlen(tap_names[k]);
+
+		if (strncmp(arg, tap_names[k], len))
+			continue;
+		t->kind = k;
+		if (k == TAP_STAGE) {
+			char *end;
+			t->stage = strtol(arg+len, &end, 10);
+			if (end == name)
+				return 1;
+		} else if (arg+len == name)
+			return 1;
+	}
+	fprintf(stderr, "Bad tap '%.*s'\n", (int) (name - arg), arg);
+	exit(1);
+}
+
+// Any analysis at all?
+static int tap_wanted(const struct render *r)
+{
+	return r->nr_taps || tap_peaks || stft_name;
+}
+
+// The names of the input and output files, if they have them
+static void tap_open(struct render *r, const char *input, const char *output)
+{
+	r->analysis = tap_wanted(r);
+	if (tap_peaks && input)
+		r->in_peaks = peaks_new(input, r->channels);
+	if (tap_peaks && output)
+		r->peaks = peaks_new(output, r->channels);
+	r->stft = stft_open(r->channels);
+
+	for (int i = 0; i < r->nr_taps; i++) {
+		struct tap *t = r->taps + i;
+
+		if (t->kind == TAP_STAGE && (t->stage < 1 || t->stage > r->chain_len)) {
+			fprintf(stderr, "Tap of stage %d, but the chain has %d\n", t->stage, r->chain_len);
+			exit(1);
+		}
+		t->fd = open(t->name, O_CREAT | O_WRONLY | O_TRUNC, 0666);
+		if (t->fd < 0) {
+			perror(t->name);
+			exit(1);
+		}
+		t->buf = malloc(TAP_FRAMES * r->channels * sizeof(s32));
+		if (!t->buf) {
+			perror("malloc");
+			exit(1);
+		}
+		for (int ch = 0; ch < r->channels; ch++)
+			process_init(t->env + ch);
+		if (tap_peaks)
+			t->peaks = peaks_new(t->name, r->channels);
+	}
+}
+
+static void tap_flush(struct render *r, struct tap *t)
+{
+	size_t size = t->pos * r->channels * sizeof(s32);
+
+	if (write(t->fd, t->buf, size) != size) {
+		perror(t->name);
+		exit(1);
+	}
+	t->pos = 0;
+}
+
+static void tap_close(struct render *r)
+{
+	for (int i = 0; i < r->nr_taps; i++) {
+		tap_flush(r, r->taps+i);
+		close(r->taps[i].fd);
+		free(r->taps[i].buf);
+		if (r->taps[i].peaks)
+			peaks_close(r->taps[i].peaks);
+	}
+	if (r->in_peaks)
+		peaks_close(r->in_peaks);
+	if (r->peaks)
+		peaks_close(r->peaks);
+	if (r->stft)
+		stft_close(r->stft);
+}
+
+// Where frame 'i' of channel 'ch' goes in this block
+static inline s32 *tap_slot(struct render *r, struct tap *t, int i, int ch)
+{
+	return t->buf + (t->pos + i) * r->channels + ch;
+}
+
+static inline s32 tap_level(unsigned int magnitude)
+{
+	return process_output(u32_to_fraction(magnitude));
+}
+
+// After every input sample
+static inline void tap_input(struct render *r, int i, int ch)
+{
+	const struct process_state *ps = r->proc + ch;
+
+	for (int k = 0; k < r->nr_taps; k++) {
+		struct tap *t = r->taps + k;
+
+		if (t->kind == TAP_IN) {
+			*tap_slot(r, t, i, ch) = tap_level(ps->magnitude);
+		} else if (t->kind == TAP_GATE) {
+#ifdef FIXED_POINT
+			*tap_slot(r, t, i, ch) = ps->noise_gate_q31;
+#else
+			*tap_slot(r, t, i, ch) = process_output(ps->noise_gate / SAMPLE_TO_FLOAT_MULTIPLIER);
+#endif
+		}
+	}
+}
+
+// After 'stage' effects of the chain
+static inline void tap_stage(struct render *r, int stage, int i, int ch, s32 val)
+{
+	for (int k = 0; k < r->nr_taps; k++) {
+		struct tap *t = r->taps + k;
+
+		if (t->kind == TAP_STAGE && t->stage == stage)
+			*tap_slot(r, t, i, ch) = val;
+	}
+}
+
+// The 'n' input and output frames of the block, which finishes it
+static void tap_output(struct render *r, const s32 *in, const s32 *out, int n)
+{
+	int channels = r->channels;
+
+	if (r->in_peaks)
+		peaks_add(r->in_peaks, in, n);
+	if (r->peaks)
+		peaks_add(r->peaks, out, n);
+	if (r->stft)
+		stft_add(r->stft, out, n);
+
+	for (int k = 0; k < r->nr_taps; k++) {
+		struct tap *t = r->taps + k;
+
+		for (int ch = 0; ch < channels; ch++) {
+			const s32 *x = out + ch;
+
+			if (t->kind == TAP_OUT) {
+				for (int i = 0; i < n; i++)
+					*tap_slot(r, t, i, ch) = tap_level(process_track(t->env + ch, x[i*channels]));
+			} else if (t->kind == TAP_PEAK || t->kind == TAP_RMS) {
+				u32 peak = 0;
+				double sum = 0;
+
+				for (int i = 0; i < n; i++) {
+					s32 val = x[i*channels];
+					u32 abs = val < 0 ? -(u32) val : val;
+
+					if (abs > peak)
+						peak = abs;
+					sum += (double) val * val;
+				}
+
+				double level = t->kind == TAP_PEAK ? peak : sqrt(sum / n);
+				if (level > 0x7fffffff)
+					level = 0x7fffffff;
+				for (int i = 0; i < n; i++)
+					*tap_slot(r, t, i, ch) = (s32) level;
+			}
+		}
+
+		if (t->peaks)
+			peaks_add(t->peaks, tap_slot(r, t, 0, 0), n);
+		t->pos += n;
+		if (t->pos > TAP_FRAMES - BLOCKSIZE)
+			tap_flush(r, t);
+	}
+}
@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../util.h"
+#include "../biquad.h"
+
+#define N 4096
+
+static float x[N], ref[N], out[N];
+
+static struct biquad_coeff coeff[BIQUAD_LANES];
+
+static float maxerr(void)
+{
+	float err = 0;
+	for (int i = 0; i < N; i++)
+		err = fmaxf(err, fabsf(out[i] - ref[i]));
+	return err;
+}
+
+static void design(void)
+{
+	_biquad_hpf(coeff+0, 80, 1);
+	_biquad_lpf(coeff+1, 3000, 0.707f);
+	_biquad_peak_eq(coeff+2, 800, 2, 1.5f);
+	_biquad_allpass_filter(coeff+3, 1500, 1);
+}
+
+// The cascade in blocks of 'block' against separate filters. The
+// math is the same, so this has to be exact
+static int test_cascade(int nr, int block)
+{
+	struct biquad_bank b = { 0 };
+	struct biquad_state s[BIQUAD_LANES] = { 0 };
+
+	for (int k = 0; k < nr; k++)
+		biquad_bank_set(&b, k, coeff+k);
+
+	for (int i = 0; i < N; i++) {
+		float val = x[i];
+		for (int k = 0; k < nr; k++)
+			val = _biquad_step(coeff+k, s+k, val);
+		ref[i] = val;
+	}
+
+	memcpy(out, x, sizeof(out));
+	for (int i = 0; i < N; i += block)
+		biquad_bank_cascade(&b, out+i, i+block > N ? N-i : block);
+
+	float err = maxerr();
+	printf("Cascade of %d in blocks of %d: max error %.3g\n", nr, block, err);
+	return err != 0;
+}
+
+// Every filter on its own input
+static int test_parallel(void)
+{
+	struct biquad_bank b = { 0 };
+	struct biquad_state s[BIQUAD_LANES] = { 0 };
+	float err = 0;
+
+	for (int k = 0; k < BIQUAD_LANES; k++)
+		biquad_bank_set(&b, k, coeff+k);
+
+	for (int i = 0; i < N; i++) {
+		float val[BIQUAD_LANES];
+
+		for (int k = 0; k < BIQUAD_LANES; k++)
+			val[k] = x[(i + 100*k) % N];
+		biquad_bank_step(&b, val);
+		for (int k = 0; k < BIQUAD_LANES; k++)
+			err = fmaxf(err, fabsf(val[k] - _biquad_step(coeff+k, s+k, x[(i + 100*k) % N])));
+	}
+	printf("Parallel bank: max error %.3g\n", err);
+	return err != 0;
+}
+
+// The gain of a filter at 'f' Hz
+static double response(const struct biquad_coeff *c, double f)
+{
+	double w = 2 * M_PI * f / SAMPLES_PER_SEC;
+	double cr = cos(w), ci = -sin(w), c2r = cos(2*w), c2i = -sin(2*w);
+	double nr = c->b0 + c->b1*cr + c->b2*c2r, ni = c->b1*ci + c->b2*c2i;
+	double dr = 1 + c->a1*cr + c->a2*c2r, di = c->a1*ci + c->a2*c2i;
+
+	return sqrt((nr*nr + ni*ni) / (dr*dr + di*di));
+}
+
+// The EQ sections should have their gain where they say
+static int test_eq(const char *name, void (*design)(struct biquad_coeff *, float, float, float),
+	float f, float gain, double at)
+{
+	struct biquad_coeff c;
+
+	design(&c, f, 0.707f, gain);
+	double g = response(&c, at);
+	double flat = response(&c, at < f ? 20000 : 20);
+
+	design(&c, f, 0.707f, 1);
+	double unity = response(&c, at);
+
+	printf("%s %g Hz x%g: %.4f at %g Hz, %.4f away from it, %.4f at unity\n",
+		name, f, gain, g, at, flat, unity);
+	return fabs(g - gain) > 0.02 * gain || fabs(flat - 1) > 0.05 || fabs(unity - 1) > 1e-4;
+}
+
+int main(int argc, char **argv)
+{
+	static const int blocks[] = { 1, 2, 3, 7, 200 };
+	int err = 0;
+
+	srand(1);
+	for (int i = 0; i < N; i++)
+		x[i] = rand() / (float)RAND_MAX - 0.5f;
+	design();
+
+	for (int nr = 1; nr <= BIQUAD_LANES; nr++)
+		for (int i = 0; i < ARRAY_SIZE(blocks); i++)
+			err |= test_cascade(nr, blocks[i]);
+	err |= test_parallel();
+
+	err |= test_eq("Peak", _biquad_peak_eq, 1000, 2, 1000);
+	err |= test_eq("Peak", _biquad_peak_eq, 1000, 0.5f, 1000);
+	err |= test_eq("Low shelf", _biquad_low_shelf, 200, 1.8f, 20);
+	err |= test_eq("High shelf", _biquad_high_shelf, 4000, 0.6f, 20000);
+	return err;
+}
@@ -0,0 +1,186 @@
+//
+// Multi-channel renders against the same channels rendered one at a
+// time: every channel has a state of its own, so setting them all up
+// at once (and running them side by side, for the effects with a
+// 'multi' function) mustn't change what any of them comes out as.
+//
+// The lanes don't round quite like the scalar step does, so they
+// only have to be within MULTI_SNR dB of it.
+//
+// Built like convert.
+//
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+
+#include "../effects.h"
+
+#define BLOCKSIZE 200
+#define CHANNELS 8		// like convert's --channels
+#define STAGES 5
+#define N 48000
+#define MULTI_SNR 100
+
+static float input[CHANNELS][N], output[CHANNELS][N], ref[N];
+
+// A bit of noise, different for every channel
+static void make_input(void)
+{
+	for (int ch = 0; ch < CHANNELS; ch++) {
+		u32 seed = ch + 1;
+
+		for (int i = 0; i < N; i++) {
+			seed = seed * 1664525 + 1013904223;
+			input[ch][i] = (i < N/4) ? 0.5f * (float) ((double) (s32) seed / 2147483648u) : 0;
+		}
+	}
+}
+
+static void *new_state(const struct effect *eff)
+{
+	float pot[4] = { 0.5f, 0.5f, 0.5f, 0.5f };
+	void *state = calloc(1, eff->size);
+
+	if (!state) {
+		perror("calloc");
+		exit(1);
+	}
+	eff->init(state, pot);
+	return state;
+}
+
+static void run_block(const struct effect *eff, void *state, float *buf, int n)
+{
+	if (eff->block)
+		eff->block(state, buf, buf, n);
+	else
+		for (int i = 0; i < n; i++)
+			buf[i] = eff->step(state, buf[i]);
+}
+
+//
+// 'stages' of 'eff' in a chain on 'channels' channels, with all of
+// the delay lines set up before the first sample. Then channel by
+// channel on its own, and that has to be bit-exact.
+//
+static int test_chain(const char *name, int stages, int channels)
+{
+	const struct effect *eff = find_effect(name, strlen(name));
+	void *state[STAGES][CHANNELS];
+	int chunks, fail = 0;
+
+	for (int j = 0; j < stages; j++)
+		for (int ch = 0; ch < channels; ch++)
+			state[j][ch] = new_state(eff);
+	chunks = delay_arena.chunks != NULL;
+
+	memcpy(output, input, sizeof(output));
+	for (int pos = 0; pos < N; pos += BLOCKSIZE)
+		for (int j = 0; j < stages; j++)
+			for (int ch = 0; ch < channels; ch++)
+				run_block(eff, state[j][ch], output[ch] + pos, BLOCKSIZE);
+
+	for (int j = 0; j < stages; j++)
+		for (int ch = 0; ch < channels; ch++)
+			effect_free(eff, state[j][ch]);
+	delay_arena_reset();
+
+	for (int ch = 0; ch < channels; ch++) {
+		memcpy(ref, input[ch], sizeof(ref));
+		for (int j = 0; j < stages; j++)
+			state[j][0] = new_state(eff);
+		for (int pos = 0; pos < N; pos += BLOCKSIZE)
+			for (int j = 0; j < stages; j++)
+				run_block(eff, state[j][0], ref + pos, BLOCKSIZE);
+		for (int j = 0; j < stages; j++)
+			effect_free(eff, state[j][0]);
+		delay_arena_reset();
+
+		if (memcmp(ref, output[ch], sizeof(ref)))
+			fail = 1;
+	}
+
+	printf("%d x %s on %d channel(s)%s: %s\n", stages, eff->name, channels,
+		chunks ? " (past the static arena)" : "", fail ? "FAIL" : "ok");
+	return fail;
+}
+
+//
+// The 'multi' function on 'channels' channels, with their LFOs a
+// quarter of a cycle apart, against every channel on its own
+// through the step function.
+//
+static int test_multi(const char *name, int channels)
+{
+	const struct effect *eff = find_effect(name, strlen(name));
+	void *state[CHANNELS];
+	float *buf[CHANNELS];
+	double worst = INFINITY;
+
+	for (int ch = 0; ch < channels; ch++) {
+		state[ch] = new_state(eff);
+		eff->lfo(state[ch])->idx = (u32) ch << 30;
+	}
+
+	memcpy(output, input, sizeof(output));
+	for (int pos = 0; pos < N; pos += BLOCKSIZE) {
+		for (int ch = 0; ch < channels; ch++)
+			buf[ch] = output[ch] + pos;
+		eff->multi(state, buf, channels, BLOCKSIZE);
+	}
+	for (int ch = 0; ch < channels; ch++)
+		effect_free(eff, state[ch]);
+
+	for (int ch = 0; ch < channels; ch++) {
+		void *s = new_state(eff);
+		double sig = 0, err = 0, snr;
+
+		eff->lfo(s)->idx = (u32) ch << 30;
+		for (int i = 0; i < N; i++) {
+			float val = eff->step(s, input[ch][i]);
+			double d = (double) val - output[ch][i];
+			sig += (double) val * val;
+			err += d * d;
+		}
+		effect_free(eff, s);
+
+		snr = err ? 10 * log10(sig / err) : INFINITY;
+		if (snr < worst)
+			worst = snr;
+	}
+
+	printf("%s multi on %d channel(s): %.1f dB (need %d): %s\n", name, channels,
+		worst, MULTI_SNR, worst < MULTI_SNR ? "FAIL" : "ok");
+	return worst < MULTI_SNR;
+}
+
+int main(int argc, char **argv)
+{
+	int fail = 0;
+
+	denormals_off();
+	fir_select();
+	make_input();
+
+	fail |= test_chain("echo", 1, 1);
+	fail |= test_chain("echo", 1, 2);
+	fail |= test_chain("echo", 1, CHANNELS);
+	fail |= test_chain("echo", 5, 1);
+	fail |= test_chain("echo", 5, CHANNELS);
+	fail |= test_chain("flanger", 2, CHANNELS);
+
+	fail |= test_multi("phaser", 1);
+	fail |= test_multi("phaser", 2);
+	fail |= test_multi("phaser", 5);
+	fail |= test_multi("phaser", CHANNELS);
+
+	return fail;
+}
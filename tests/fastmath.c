@@ -0,0 +1,59 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../util.h"
+
+// What it has to stay within, with a bit of room over what it does
+#define EXP2_LIMIT 2e-7
+#define LOG2_LIMIT 2e-7
+#define POW_LIMIT 1e-6
+
+int main(int argc, char **argv)
+{
+	double maxexp = 0, maxlog = 0, maxpow = 0;
+	float worstexp = 0, worstlog = 0, worstpow = 0;
+
+	for (float x = -30; x < 30; x += 0.0001f) {
+		double e = fabs(fast_exp2(x) / exp2(x) - 1);
+		if (e > maxexp) {
+			maxexp = e;
+			worstexp = x;
+		}
+	}
+
+	// Don't count the final rounding of large results
+	for (float x = 1e-6f; x < 1e6f; x *= 1.00001f) {
+		double exact = log2(x);
+		double e = fabs(fast_log2(x) - exact) - fabs(exact) * 0x1p-24;
+		if (e > maxlog) {
+			maxlog = e;
+			worstlog = x;
+		}
+	}
+
+	// The tube curve range, relative error
+	for (float x = 0.001f; x < 40; x += 0.0001f) {
+		double e = fabs(fast_pow(x, 1.5f) / pow(x, 1.5) - 1);
+		if (e > maxpow) {
+			maxpow = e;
+			worstpow = x;
+		}
+	}
+
+	printf("Max exp2() relative error %.3g at %g (%.1f digits, limit %.3g)\n", maxexp, worstexp, -log10(maxexp), EXP2_LIMIT);
+	printf("Max log2() absolute error %.3g (+1ulp) at %g (%.1f digits, limit %.3g)\n", maxlog, worstlog, -log10(maxlog), LOG2_LIMIT);
+	printf("Max pow(x,1.5) relative error %.3g at %g (%.1f digits, limit %.3g)\n", maxpow, worstpow, -log10(maxpow), POW_LIMIT);
+	if (maxexp > EXP2_LIMIT || maxlog > LOG2_LIMIT || maxpow > POW_LIMIT) {
+		printf("Over the limit\n");
+		return 1;
+	}
+
+	for (int i = -126; i <= 127; i++) {
+		if (fast_exp2(i) != ldexpf(1, i)) {
+			printf("exp2(%d) is not exact\n", i);
+			return 1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,252 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+
+#include "../util.h"
+#include "../fir.h"
+#include "../fft.h"
+#include "../convolve.h"
+#include "../ir.h"
+#include "../lfo.h"
+#include "../effect.h"
+#include "../biquad.h"
+#include "../waveshaper.h"
+#include "../distortion.h"
+
+#define N 4096
+
+static float x[N], ir[1500], ref[N], out[N];
+
+// Plain direct-form convolution to compare against
+static void reference(int len)
+{
+	for (int i = 0; i < N; i++) {
+		double sum = 0;
+		for (int k = 0; k < len && k <= i; k++)
+			sum += ir[k] * x[i-k];
+		ref[i] = sum;
+	}
+}
+
+static float maxerr(void)
+{
+	float err = 0;
+	for (int i = 0; i < N; i++)
+		err = fmaxf(err, fabsf(out[i] - ref[i]));
+	return err;
+}
+
+static void test_kernel(const char *name, fir_kernel_t *kernel)
+{
+	struct fir f;
+	int len = 40;
+
+	fir_kernel = kernel;
+	reference(len);
+	fir_init(&f, ir, len);
+	for (int i = 0; i < N; i++)
+		out[i] = fir_step(&f, x[i]);
+	printf("Max %s FIR step error %.3g\n", name, maxerr());
+
+	fir_free(&f);
+	fir_init(&f, ir, len);
+	for (int i = 0; i < N; i += 100)
+		fir_block(&f, x+i, out+i, i+100 > N ? N-i : 100);
+	printf("Max %s FIR block error %.3g\n", name, maxerr());
+	fir_free(&f);
+}
+
+static void test_convolver(int len, int B)
+{
+	struct convolver c;
+
+	reference(len);
+	convolver_init(&c, ir, len, B);
+	for (int i = 0; i < N; i += 200)
+		convolver_block(&c, x+i, out+i, i+200 > N ? N-i : 200);
+	printf("Max convolver error %.3g (%d taps, %d partition)\n", maxerr(), len, B);
+	convolver_free(&c);
+}
+
+// One load of the IR file through ir.h, which has to come out the
+// same as the convolver with the converted taps
+static int ir_run(const char *name, int mapped)
+{
+	struct convolver c;
+	int len = ir_load(&c, name, 64);
+
+	if (len != ARRAY_SIZE(ir)) {
+		printf("IR load of %s returned %d\n", name, len);
+		return 1;
+	}
+	for (int i = 0; i < N; i += 200)
+		convolver_block(&c, x+i, out+i, i+200 > N ? N-i : 200);
+	convolver_free(&c);
+
+	int bad = memcmp(out, ref, sizeof(out)) || !c.map != !mapped;
+	printf("IR %s: %s the cache%s\n", mapped ? "mapped" : "built",
+		c.map ? "from" : "into", bad ? ", FAILED" : "");
+	return bad;
+}
+
+// Worked out and cached, from the cache, and worked out again
+// once the IR changes
+static int test_ir(void)
+{
+	static s32 raw[ARRAY_SIZE(ir)];
+	float taps[ARRAY_SIZE(ir)];
+	char dir[] = "/tmp/irtestXXXXXX", name[64], cache[80];
+	struct timespec later[2] = { { 0, UTIME_NOW }, { 1000000000, 0 } };
+	struct convolver c;
+	int fd, err = 0;
+
+	for (int i = 0; i < ARRAY_SIZE(ir); i++) {
+		raw[i] = (s32) (ir[i] * 0x7fffffff);
+		taps[i] = raw[i] / 2147483648.0;
+	}
+	convolver_init(&c, taps, ARRAY_SIZE(ir), 64);
+	for (int i = 0; i < N; i += 200)
+		convolver_block(&c, x+i, ref+i, i+200 > N ? N-i : 200);
+	convolver_free(&c);
+
+	if (!mkdtemp(dir)) {
+		perror("mkdtemp");
+		return 1;
+	}
+	snprintf(name, sizeof(name), "%s/ir.raw", dir);
+	snprintf(cache, sizeof(cache), "%s.cache", name);
+	fd = open(name, O_CREAT | O_WRONLY | O_TRUNC, 0666);
+	if (fd < 0 || write(fd, raw, sizeof(raw)) != sizeof(raw)) {
+		perror(name);
+		return 1;
+	}
+	close(fd);
+
+	err |= ir_run(name, 0);
+	err |= ir_run(name, 1);
+	utimensat(AT_FDCWD, name, later, 0);
+	err |= ir_run(name, 0);
+	err |= ir_run(name, 1);
+
+	unlink(cache);
+	unlink(name);
+	rmdir(dir);
+	if (ir_load(&c, name, 64) >= 0) {
+		printf("IR load of a missing file worked\n");
+		err = 1;
+	}
+	return err;
+}
+
+// The distortion table against the curves it was baked from, over
+// full scale input, at 'drive' (linear in the pot from 1x to 50x)
+static int test_distortion(float drive, double max)
+{
+	static const char *const names[] = { "soft", "hard", "asymmetric" };
+	float pot[4] = { (drive - 1) / 49, 0.5f, 1, 0 };
+	int err = 0;
+
+	for (int mode = 0; mode < 3; mode++) {
+		struct distortion_state *d = calloc(1, sizeof(*d));
+		double e = 0;
+
+		pot[3] = mode / 3.0f + 0.1f;
+		distortion_init(d, pot);
+		for (float in = -1; in <= 1; in += 0x1p-16f)
+			e = fmax(e, fabs(waveshaper_lookup(&d->shaper, in) - distortion_curves[mode](in * drive)));
+		printf("Max %s distortion table error %.3g at %gx drive\n", names[mode], e, drive);
+		err |= e > max;
+		distortion_fini(d);
+		free(d);
+	}
+	return err;
+}
+
+static float identity(float x)
+{
+	return x;
+}
+
+//
+// A straight line through the oversampled waveshaper: sines at
+// passband frequencies have to come out at unity gain, 'latency'
+// samples late (at all of them, since the filters are linear phase).
+// Going by the least squares fit of a sine and cosine
+// at the same frequency, past the filters' startup.
+//
+static int test_oversample(int oversample, double latency)
+{
+	static const float freqs[] = { 100, 1000, 5000, 10000, 15000 };
+	static struct waveshaper ws;
+	double maxgain = 0, maxdelay = 0;
+
+	for (int f = 0; f < ARRAY_SIZE(freqs); f++) {
+		double w = 2 * M_PI * freqs[f] / 48000, ss = 0, cc = 0, sc = 0, ys = 0, yc = 0;
+
+		waveshaper_init(&ws, oversample);
+		waveshaper_bake(&ws, identity, 1);
+		waveshaper_set_gain(&ws, 1);
+		for (int i = 0; i < N; i++)
+			ref[i] = (float) (0.5 * sin(w * i));
+		waveshaper_block(&ws, ref, out, N);
+		waveshaper_free(&ws);
+
+		for (int i = 256; i < N; i++) {
+			double s = sin(w * i), c = cos(w * i);
+			ss += s*s; cc += c*c; sc += s*c;
+			ys += out[i] * s; yc += out[i] * c;
+		}
+
+		// out = a sin(wi) + b cos(wi) = A sin(w (i - delay))
+		double det = ss*cc - sc*sc;
+		double a = (ys*cc - yc*sc) / det, b = (yc*ss - ys*sc) / det;
+		double gain = 20 * log10(2 * sqrt(a*a + b*b));
+		double delay = -atan2(b, a) / w;
+
+		// Give or take whole periods, only 100Hz has one longer than that
+		maxdelay = fmax(maxdelay, fabs(remainder(delay - latency, 2 * M_PI / w)));
+		maxgain = fmax(maxgain, fabs(gain));
+	}
+	printf("%dx waveshaper: passband gain within %.3g dB, latency off by %.3g samples from %g\n",
+		oversample, maxgain, maxdelay, latency);
+	return maxgain > 0.01 || maxdelay > 0.001;
+}
+
+int main(int argc, char **argv)
+{
+	srand(1);
+	for (int i = 0; i < N; i++)
+		x[i] = rand() / (float)RAND_MAX - 0.5f;
+	for (int i = 0; i < ARRAY_SIZE(ir); i++)
+		ir[i] = (rand() / (float)RAND_MAX - 0.5f) * expf(-i / 300.0f);
+
+	test_kernel("scalar", fir_kernel_scalar);
+#if defined(__x86_64__) || defined(__i386__)
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		test_kernel("avx2", fir_kernel_avx2);
+#endif
+#ifdef __ARM_NEON
+	test_kernel("neon", fir_kernel_neon);
+#endif
+
+	fir_select();
+	printf("Using %s FIR kernel\n", fir_kernel_name);
+	test_convolver(1024, 64);
+	test_convolver(1500, 64);
+	test_convolver(40, 64);
+	test_convolver(1024, 256);
+	int err = test_ir();
+	err |= test_distortion(1, 1e-6);
+	err |= test_distortion(10, 3e-5);
+	err |= test_distortion(50, 2.5e-4);
+	err |= test_oversample(2, 23);
+	err |= test_oversample(4, 34.5);
+	return err;
+}
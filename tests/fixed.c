@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define FIXED_POINT
+
+#include "../util.h"
+#include "../lfo.h"
+#include "../effect.h"
+#include "../biquad.h"
+#include "../flanger.h"
+#include "../echo.h"
+#include "../phaser.h"
+
+#define N 48000
+
+static float x[N], out[N];
+static q31 qx[N], qout[N];
+static double ref[N];
+
+// Signal to noise ratio of 'out' against 'ref', in dB
+static double snr(const double *ref, const float *out)
+{
+	double sig = 0, err = 0;
+
+	for (int i = 0; i < N; i++) {
+		sig += ref[i] * ref[i];
+		err += (out[i] - ref[i]) * (out[i] - ref[i]);
+	}
+	return 10 * log10(sig / err);
+}
+
+// Filter 'x' with a biquad in double, float and Q2.30. The fixed-point
+// version should be at least as close to the double one as float is
+static int test_biquad(const char *name, void (*design)(struct biquad_coeff *, float, float), float f, float Q)
+{
+	struct biquad_coeff c;
+	struct biquad_q30 q;
+	double dx[2] = { 0 }, dy[2] = { 0 };
+	float fx[2] = { 0 }, fy[2] = { 0 };
+	s32 sx[2] = { 0 }, sy[2] = { 0 };
+
+	design(&c, f, Q);
+	biquad_q30_set(&q, &c);
+
+	for (int i = 0; i < N; i++) {
+		double y = c.b0*x[i] + c.b1*dx[0] + c.b2*dx[1] - c.a1*dy[0] - c.a2*dy[1];
+		dx[1] = dx[0]; dx[0] = x[i];
+		dy[1] = dy[0]; dy[0] = y;
+		ref[i] = y;
+	}
+
+	for (int i = 0; i < N; i++)
+		out[i] = biquad_step_df1(&c, x[i], fx, fy);
+	double fsnr = snr(ref, out);
+
+	for (int i = 0; i < N; i++) {
+		s32 in = qx[i] >> FIXED_HEADROOM;
+		out[i] = q31_to_float(biquad_q30_step_df1(&q, in, sx, sy)) * (1 << FIXED_HEADROOM);
+	}
+	double qsnr = snr(ref, out);
+
+	printf("%s %g Hz: float %.1f dB, Q2.30 %.1f dB\n", name, f, fsnr, qsnr);
+	return qsnr < fsnr;
+}
+
+// A bank cascade stays Q2.29 between the filters, so it should
+// do at least as well as separate float filters
+static int test_bank(void)
+{
+	struct biquad_coeff c[2];
+	struct biquad_bank b = { 0 };
+	double dx[2][2] = { 0 }, dy[2][2] = { 0 };
+	float fx[2][2] = { 0 }, fy[2][2] = { 0 };
+
+	_biquad_hpf(c+0, 100, 1);
+	_biquad_lpf(c+1, 3000, 1);
+	biquad_bank_set(&b, 0, c+0);
+	biquad_bank_set(&b, 1, c+1);
+
+	for (int i = 0; i < N; i++) {
+		double y = x[i];
+		for (int k = 0; k < 2; k++) {
+			double in = y;
+			y = c[k].b0*in + c[k].b1*dx[k][0] + c[k].b2*dx[k][1] - c[k].a1*dy[k][0] - c[k].a2*dy[k][1];
+			dx[k][1] = dx[k][0]; dx[k][0] = in;
+			dy[k][1] = dy[k][0]; dy[k][0] = y;
+		}
+		ref[i] = y;
+	}
+
+	for (int i = 0; i < N; i++)
+		out[i] = biquad_step_df1(c+1, biquad_step_df1(c+0, x[i], fx[0], fy[0]), fx[1], fy[1]);
+	double fsnr = snr(ref, out);
+
+	memcpy(out, x, sizeof(out));
+	for (int i = 0; i < N; i += 200)
+		biquad_bank_cascade(&b, out+i, 200);
+	double qsnr = snr(ref, out);
+
+	printf("Bank cascade: float %.1f dB, Q2.30 %.1f dB\n", fsnr, qsnr);
+	return qsnr < fsnr;
+}
+
+// The fractional delay read against plain double interpolation
+static int test_delay(void)
+{
+	struct sample_array sa;
+
+	if (sample_array_init(&sa, 200))
+		return 1;
+
+	for (int i = 0; i < N; i++) {
+		float delay = 100 + 50 * sinf(i * 0.001f);
+		int d = (int) delay;
+		double frac = delay - d;
+
+		sample_array_write_q31(&sa, qx[i]);
+		out[i] = q31_to_float(sample_array_read_q31(&sa, delay));
+
+		double a = i >= d ? x[i-d] : 0;
+		double b = i >= d-1 ? x[i-d+1] : 0;
+		ref[i] = a + (b-a)*frac;
+	}
+
+	double qsnr = snr(ref, out);
+	printf("Delay read: Q31 %.1f dB\n", qsnr);
+	return qsnr < 130;
+}
+
+// An effect's fixed-point block against its float block
+static int test_effect(const struct effect *eff, float p0, float p1, float p2, float p3, double min)
+{
+	float pot[4] = { p0, p1, p2, p3 };
+	void *fs = calloc(1, eff->size), *qs = calloc(1, eff->size);
+
+	for (int i = 0; i < N; i += 200) {
+		eff->init(fs, pot);
+		eff->block(fs, x+i, out+i, 200);
+		eff->init(qs, pot);
+		eff->fixed(qs, qx+i, qout+i, 200);
+	}
+
+	for (int i = 0; i < N; i++) {
+		ref[i] = out[i];
+		out[i] = q31_to_float(qout[i]);
+	}
+	effect_free(eff, fs);
+	effect_free(eff, qs);
+	delay_arena_reset();
+
+	double qsnr = snr(ref, out);
+	printf("%s: Q31 vs float %.1f dB\n", eff->name, qsnr);
+	return qsnr < min;
+}
+
+//
+// Full-scale input with the allpass chain already saturated. At the
+// pots' 0.75 feedback the Q2.29 feedback sum just fits in 32 bits,
+// so push the feedback past that: the sum has to clip, not wrap
+// around to a full-scale click the other way
+//
+static int test_phaser_hot(void)
+{
+	float pot[4] = { 0.3f, 1, 0.5f, 0.5f };
+	struct phaser_state *phaser = calloc(1, phaser_effect.size);
+	q31 out;
+	int wrong = 0;
+
+	phaser_effect.init(phaser, pot);
+	phaser->feedback = 0.9f;
+	for (int neg = 0; neg < 2; neg++) {
+		q31 full = neg ? -0x7ff00000 : 0x7ff00000;
+
+		phaser->q3[0] = phaser->q3[1] = full;
+		phaser_effect.fixed(phaser, &full, &out, 1);
+
+		// What went into the first allpass
+		wrong |= (phaser->q0[0] < 0) != neg;
+	}
+	effect_free(&phaser_effect, phaser);
+	printf("phaser: saturated feedback %s\n", wrong ? "WRAPS AROUND" : "clips");
+	return wrong;
+}
+
+int main(int argc, char **argv)
+{
+	int err = 0;
+
+	srand(1);
+	for (int i = 0; i < N; i++) {
+		float noise = (float) rand() / RAND_MAX - 0.5f;
+		x[i] = 0.3f * sinf(i * 0.0131f) + 0.2f * sinf(i * 0.173f) + 0.1f * noise;
+		qx[i] = float_to_q31(x[i]);
+		x[i] = q31_to_float(qx[i]);
+	}
+
+	err |= test_biquad("LPF", _biquad_lpf, 300, 0.707f);
+	err |= test_biquad("HPF", _biquad_hpf, 100, 1);
+	err |= test_biquad("LPF", _biquad_lpf, 5000, 1);
+	err |= test_biquad("Allpass", _biquad_allpass_filter, 1000, 1);
+	err |= test_bank();
+	err |= test_delay();
+
+	err |= test_effect(&echo_effect, 0.3f, 0.3f, 0.3f, 0.6f, 120);
+	err |= test_effect(&flanger_effect, 0.6f, 0.6f, 0.6f, 0.6f, 120);
+	err |= test_effect(&phaser_effect, 0.3f, 0.7f, 0.5f, 0.5f, 80);
+	err |= test_phaser_hot();
+	return err;
+}
@@ -0,0 +1,309 @@
+//
+// Golden-output regression test
+//
+//	tests/golden [--update] [--exact] [--snr=DB] [--record=FILE] [effect...]
+//
+// renders every effect (or just the ones given) with fixed pots over
+// a deterministic test signal, BLOCKSIZE samples at a time like
+// convert, and compares the output with the one stored in
+// tests/goldens/<effect>.raw (s32 samples, like output.raw).
+//
+// The fixed-point build of the same thing (tests/golden-fixed) runs
+// the effects that have a Q31 version against <effect>-fixed.raw,
+// and that has to be bit-exact: it's all integer math. The float
+// effects only have to be within --snr dB (90 by default) of their
+// golden output, since the compiler and the kernels picked at runtime
+// (fir.h) can round differently. With --exact they have to be
+// bit-exact too, eg to check a change that should be a plain
+// refactor on the machine that wrote the goldens.
+//
+// --update writes the goldens instead, after a change that is meant
+// to change the output (say so in the commit).
+//
+// Every line also has the throughput, the best of a few renders, and
+// --record=FILE appends the lines to FILE with the date and the git
+// revision, if there is one, to keep track of it over time:
+//
+//	effect build result snr ns/sample %realtime
+//
+// Tube runs without an impulse response, so that it doesn't depend
+// on some FIR.raw from wherever the test is run. 'magnitude' is left
+// out, as it's only the envelope that convert works out.
+//
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <math.h>
+
+#include "../effects.h"
+
+#define BLOCKSIZE 200
+#define GOLDEN_SAMPLES 12000
+#define GOLDEN_RUNS 5
+#define GOLDEN_DIR "tests/goldens"
+
+#ifdef FIXED_POINT
+#define GOLDEN_BUILD "fixed"
+#else
+#define GOLDEN_BUILD "float"
+#endif
+
+static q31 input[GOLDEN_SAMPLES], output[GOLDEN_SAMPLES], golden[GOLDEN_SAMPLES];
+
+static const float golden_pots[4] = { 0.1f, 0.6f, 0.4f, 0.7f };
+
+static int update, exact;
+static double min_snr = 90;
+static FILE *record;
+static char revision[64] = "-";
+
+//
+// A quarter of a second of: two tones, an impulse and the ring after
+// it, a burst of noise and the tail after that. All of it worked out
+// in integers (or rounded to them) so it's the same everywhere.
+//
+static void make_input(void)
+{
+	u32 seed = 1;
+
+	for (int i = 0; i < GOLDEN_SAMPLES; i++) {
+		double val = 0;
+
+		if (i < 6000) {
+			double t = (double) i / 48000;
+			val = 0.4 * sin(2 * M_PI * 110 * t) + 0.2 * sin(2 * M_PI * 1234 * t);
+			val *= i / 6000.0;
+		} else if (i == 6000) {
+			val = 0.9;
+		} else if (i >= 9000 && i < 10500) {
+			seed = seed * 1664525 + 1013904223;
+			val = 0.3 * ((double) (s32) seed / 2147483648u);
+		}
+		input[i] = (q31) lrint(val * 0x7fffffff);
+	}
+}
+
+static void render(const struct effect *eff, void *state, int fixed)
+{
+	float pot[4], tmp[BLOCKSIZE];
+
+	memcpy(pot, golden_pots, sizeof(pot));
+	eff->init(state, pot);
+
+	for (int pos = 0; pos < GOLDEN_SAMPLES; pos += BLOCKSIZE) {
+		const q31 *in = input + pos;
+		q31 *out = output + pos;
+
+#ifdef FIXED_POINT
+		if (fixed) {
+			eff->fixed(state, in, out, BLOCKSIZE);
+			continue;
+		}
+#endif
+		for (int i = 0; i < BLOCKSIZE; i++)
+			tmp[i] = q31_to_float(in[i]);
+		if (eff->block)
+			eff->block(state, tmp, tmp, BLOCKSIZE);
+		else
+			for (int i = 0; i < BLOCKSIZE; i++)
+				tmp[i] = eff->step(state, tmp[i]);
+		for (int i = 0; i < BLOCKSIZE; i++)
+			out[i] = float_to_q31(tmp[i]);
+	}
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	// Single-precision constants, so keep the seconds out of float
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double) ts.tv_sec + (double) ts.tv_nsec / 1000000000;
+}
+
+// A fresh state for every render, and the best time of them
+static double run(const struct effect *eff, int fixed)
+{
+	double best = 1e9;
+
+	for (int r = 0; r < GOLDEN_RUNS; r++) {
+		void *state = calloc(1, eff->size ? eff->size : 1);
+
+		if (!state) {
+			perror("calloc");
+			exit(1);
+		}
+		double t = now();
+		render(eff, state, fixed);
+		t = now() - t;
+		if (t < best)
+			best = t;
+		effect_free(eff, state);
+		delay_arena_reset();
+	}
+	return best;
+}
+
+static int golden_file(const char *name, int write_it)
+{
+	int fd, size = sizeof(golden);
+
+	if (write_it) {
+		fd = open(name, O_CREAT | O_WRONLY | O_TRUNC, 0666);
+		if (fd < 0 || write(fd, output, size) != size) {
+			perror(name);
+			exit(1);
+		}
+		close(fd);
+		return 0;
+	}
+
+	fd = open(name, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	int n = read(fd, golden, size);
+	close(fd);
+	return n == size ? 0 : -1;
+}
+
+// Signal to noise ratio of the output against the golden one, in dB
+// (when they aren't the same, -ffast-math doesn't do infinities)
+static double snr(void)
+{
+	double sig = 0, err = 0;
+
+	for (int i = 0; i < GOLDEN_SAMPLES; i++) {
+		double d = (double) output[i] - golden[i];
+
+		sig += (double) golden[i] * golden[i];
+		err += d * d;
+	}
+	return sig > err ? 10 * log10(sig / err) : 0;
+}
+
+static int test_effect(const struct effect *eff)
+{
+	char name[256], line[256], db[32] = "-";
+	const char *result = "ok";
+	int fixed = 0, failed = 0;
+
+	// That one just shows the envelope of convert's input
+	if (eff == &magnitude_effect)
+		return 0;
+#ifdef FIXED_POINT
+	if (!eff->fixed)
+		return 0;
+	fixed = 1;
+	snprintf(name, sizeof(name), "%s-fixed.raw", eff->name);
+#else
+	snprintf(name, sizeof(name), "%s.raw", eff->name);
+#endif
+
+	double t = run(eff, fixed);
+
+	if (update) {
+		golden_file(name, 1);
+		result = "updated";
+	} else if (golden_file(name, 0)) {
+		result = "missing";
+		failed = 1;
+	} else if (!memcmp(output, golden, sizeof(golden))) {
+		strcpy(db, "exact");
+	} else {
+		double snr_db = snr();
+
+		snprintf(db, sizeof(db), "%.1f", snr_db);
+		failed = fixed || exact || snr_db < min_snr;
+		if (failed)
+			result = "FAILED";
+	}
+
+	double ns = t * 1e9 / GOLDEN_SAMPLES;
+	snprintf(line, sizeof(line), "%s\t%s\t%s\t%s\t%.2f\t%.3f",
+		eff->name, GOLDEN_BUILD, result, db, ns, 100 * ns / (1e9 / SAMPLES_PER_SEC));
+	printf("%s\n", line);
+
+	if (record) {
+		char date[32];
+		time_t now = time(NULL);
+
+		strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", localtime(&now));
+		fprintf(record, "%s\t%s\t%s\n", date, revision, line);
+	}
+	return failed;
+}
+
+// The revision from git, for --record
+static void get_revision(void)
+{
+	FILE *f = popen("git rev-parse --short HEAD 2>/dev/null", "r");
+
+	if (!f)
+		return;
+	if (fgets(revision, sizeof(revision), f))
+		revision[strcspn(revision, "\n")] = 0;
+	if (!revision[0])
+		strcpy(revision, "-");
+	pclose(f);
+}
+
+int main(int argc, char **argv)
+{
+	const struct effect *only[ARRAY_SIZE(effects)];
+	int nr = 0, err = 0;
+
+	for (int i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+
+		if (!strcmp(arg, "--update")) {
+			update = 1;
+		} else if (!strcmp(arg, "--exact")) {
+			exact = 1;
+		} else if (!strncmp(arg, "--snr=", 6)) {
+			min_snr = strtod(arg+6, NULL);
+		} else if (!strncmp(arg, "--record=", 9)) {
+			get_revision();
+			record = fopen(arg+9, "a");
+			if (!record) {
+				perror(arg+9);
+				exit(1);
+			}
+		} else {
+			const struct effect *eff = find_effect(arg, strlen(arg));
+			if (!eff || nr == ARRAY_SIZE(only)) {
+				fprintf(stderr, "usage: golden [--update] [--exact] [--snr=DB] [--record=FILE] [effect...]\n");
+				exit(1);
+			}
+			only[nr++] = eff;
+		}
+	}
+
+	if (chdir(GOLDEN_DIR)) {
+		perror(GOLDEN_DIR);
+		exit(1);
+	}
+	denormals_off();
+	fir_select();
+	tube_ir = NULL;
+	make_input();
+
+	printf("# effect\tbuild\tresult\tsnr\tns/sample\t%%realtime\n");
+	if (nr) {
+		for (int i = 0; i < nr; i++)
+			err |= test_effect(only[i]);
+	} else {
+		for (int i = 0; i < ARRAY_SIZE(effects); i++)
+			err |= test_effect(effects[i]);
+	}
+	if (record)
+		fclose(record);
+	return err;
+}
@@ -1,36 +1,443 @@
+//
+// Exhaustive accuracy sweeps of the LFO waveforms and the fast math
+//
+//	tests/lfo [--threads=N] [sweep...]
+//
+// checks every phase of all the lfo_type waveforms (all 2**32 of
+// them), fastsincos() of every float in 0 .. 1, fast_exp2() of
+// every float in -1 .. 1 (which is every fraction its polynomial
+// ever sees, the rest is exact power-of-two scaling) and fast_log2()
+// of every positive normal float, against double math. For each it
+// prints the max and RMS error, where the worst one was and the
+// limit it has to stay within.
+//
+// The work is split up by phase into chunks that the threads (one
+// per CPU by default) take in turn, and every chunk is done a block
+// at a time with the vectorizable _fill() versions. The exact values
+// don't need a libm call per sample either: within a block the phase
+// steps evenly, so the reference is one sin/cos (or exp2) of the
+// start of the block and angle addition with a table of the offsets.
+//
+// It's built with the same flags as convert and runs with the
+// denormals off like it, so it's the code convert runs that gets
+// checked.
+//
+// Give sweep names (or the start of them, eg "lfo") to run only
+// those.
+//
+#define _GNU_SOURCE
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
 #include <math.h>
 
-#define SAMPLES_PER_SEC (48000.0)
-
 #include "../util.h"
 #include "../lfo.h"
 
-static struct lfo_state lfo;
+#define BLOCK 4096
+#define CHUNK (1u << 22)
+
+// Linear interpolation of the quarter sine table (or half a step
+// without it), plus float rounding
+#ifdef QUARTER_SINE_NEAREST
+#define SINE_LIMIT (two_pi / 4 / QUARTER_SINE_STEPS / 2 + 2e-7)
+#define SINE_LOOKUP "nearest"
+#else
+#define SINE_LIMIT (pow(two_pi / 4 / QUARTER_SINE_STEPS, 2) / 8 + 2e-7)
+#define SINE_LOOKUP "linear"
+#endif
+
+// The sweep loops also get an AVX2 version where the CPU has it (but
+// not FMA, which would round the waveforms differently from convert)
+#if defined(__x86_64__) || defined(__i386__)
+#define SWEEP_KERNEL __attribute__((target_clones("avx2", "default")))
+#else
+#define SWEEP_KERNEL
+#endif
+
+struct worker;
+
+struct sweep {
+	const char *name[2];
+	u32 first, end;		// codes first .. end-1, CHUNK aligned
+	int is_float;		// codes are float bit patterns
+	u32 sign;		// .. with this sign bit
+	double limit;
+	void (*block)(struct worker *w, const struct sweep *s, u32 code, float err[2][BLOCK]);
+
+	// Every job is a chunk, numbered through all the sweeps
+	int job, jobs, wanted;
+};
+
+struct result {
+	double max, sum;
+	u32 worst;
+};
+
+enum table_kind { TABLE_NONE, TABLE_SINCOS, TABLE_EXP2 };
+
+struct worker {
+	pthread_t thread;
+
+	// sin/cos or exp2 of the offsets in a block at this spacing
+	enum table_kind kind;
+	double spacing;
+	double ta[BLOCK], tb[BLOCK];
+
+	float val[2][BLOCK];
+	float err[2][BLOCK];
+	struct result *res;
+};
+
+// Built like convert, so the constants are all float: work the
+// ones that need to be exact out in double
+static double two_pi, offset[BLOCK];
+
+// log2 of every float mantissa, for fast_log2
+static double *log2_mantissa;
+
+static int nr_sweeps, nr_jobs;
+static atomic_uint next_job;
+
+union bits {
+	float f;
+	u32 u;
+};
+
+static inline float bits_float(u32 u)
+{
+	union bits b = { .u = u };
+	return b.f;
+}
+
+// The phase of the first code of a block and the step between codes.
+// Chunks never cross a binade, so the float step is the same over one
+static double block_start(const struct sweep *s, u32 code, double *step)
+{
+	if (!s->is_float) {
+		*step = 0x1p-32;
+		return (double) code * 0x1p-32;
+	}
+	int e = code >> 23;
+	*step = ldexp(1, (e ? e : 1) - 150);
+	return bits_float(code);
+}
+
+static void use_table(struct worker *w, enum table_kind kind, double step)
+{
+	if (w->kind == kind && w->spacing == step)
+		return;
+	w->kind = kind;
+	w->spacing = step;
+	for (int i = 0; i < BLOCK; i++) {
+		if (kind == TABLE_SINCOS) {
+			w->ta[i] = sin(two_pi * step * i);
+			w->tb[i] = cos(two_pi * step * i);
+		} else {
+			w->ta[i] = exp2(step * i);
+		}
+	}
+}
+
+SWEEP_KERNEL
+static void lfo_sinewave_block(struct worker *w, const struct sweep *s, u32 code, float err[2][BLOCK])
+{
+	struct lfo_state lfo = { .idx = code, .step = 1 };
+	double step, p = block_start(s, code, &step);
+	double s0 = sin(two_pi * p), c0 = cos(two_pi * p);
+	const float *val = w->val[0];
+
+	use_table(w, TABLE_SINCOS, step);
+	lfo_sinewave_fill(&lfo, w->val[0], BLOCK);
+	for (int i = 0; i < BLOCK; i++)
+		err[0][i] = (float) fabs(val[i] - (s0 * w->tb[i] + c0 * w->ta[i]));
+}
+
+// These are exact in double: it's all scaling by powers of two
+SWEEP_KERNEL
+static void lfo_triangle_block(struct worker *w, const struct sweep *s, u32 code, float err[2][BLOCK])
+{
+	struct lfo_state lfo = { .idx = code, .step = 1 };
+	const float *val = w->val[0];
+
+	lfo_triangle_fill(&lfo, w->val[0], BLOCK);
+	for (int i = 0; i < BLOCK; i++) {
+		// Three quarters on, the phase as a signed number is
+		// zero at the peak and -2 .. 2 (times 2**30) around it
+		double exact = 1 - fabs((double) (s32) (code + i + 0xc0000000) * 0x1p-30);
+		err[0][i] = (float) fabs(val[i] - exact);
+	}
+}
+
+SWEEP_KERNEL
+static void lfo_sawtooth_block(struct worker *w, const struct sweep *s, u32 code, float err[2][BLOCK])
+{
+	struct lfo_state lfo = { .idx = code, .step = 1 };
+	double step, p = block_start(s, code, &step);
+	const float *val = w->val[0];
+
+	lfo_sawtooth_fill(&lfo, w->val[0], BLOCK);
+	for (int i = 0; i < BLOCK; i++)
+		err[0][i] = (float) fabs(val[i] - (p + offset[i] * step));
+}
+
+SWEEP_KERNEL
+static void fastsincos_block(struct worker *w, const struct sweep *s, u32 code, float err[2][BLOCK])
+{
+	double step, p = block_start(s, code, &step);
+	double s0 = sin(two_pi * p), c0 = cos(two_pi * p);
+	float *vs = w->val[0], *vc = w->val[1];
+
+	use_table(w, TABLE_SINCOS, step);
+	for (int i = 0; i < BLOCK; i++) {
+		struct sincos sc = fastsincos(bits_float(code + i));
+		vs[i] = sc.sin;
+		vc[i] = sc.cos;
+	}
+	for (int i = 0; i < BLOCK; i++) {
+		err[0][i] = (float) fabs(vs[i] - (s0 * w->tb[i] + c0 * w->ta[i]));
+		err[1][i] = (float) fabs(vc[i] - (c0 * w->tb[i] - s0 * w->ta[i]));
+	}
+}
+
+// Relative error
+SWEEP_KERNEL
+static void fast_exp2_block(struct worker *w, const struct sweep *s, u32 code, float err[2][BLOCK])
+{
+	double step, p = block_start(s, code, &step);
+	float *val = w->val[0];
+
+	use_table(w, TABLE_EXP2, step);
+	for (int i = 0; i < BLOCK; i++)
+		val[i] = fast_exp2(bits_float((code + i) | s->sign));
+	if (s->sign) {
+		double e0 = exp2(-p);
+		for (int i = 0; i < BLOCK; i++)
+			err[0][i] = (float) fabs(val[i] * w->ta[i] / e0 - 1);
+	} else {
+		double e0 = exp2(p);
+		for (int i = 0; i < BLOCK; i++)
+			err[0][i] = (float) fabs(val[i] / (e0 * w->ta[i]) - 1);
+	}
+}
+
+// Absolute error, not counting the final rounding of large results
+SWEEP_KERNEL
+static void fast_log2_block(struct worker *w, const struct sweep *s, u32 code, float err[2][BLOCK])
+{
+	int e = (int) (code >> 23) - 127;
+	const double *l = log2_mantissa + (code & 0x7fffff);
+	float *val = w->val[0];
+
+	for (int i = 0; i < BLOCK; i++)
+		val[i] = fast_log2(bits_float(code + i));
+	for (int i = 0; i < BLOCK; i++) {
+		double exact = e + l[i];
+		double d = fabs(val[i] - exact) - fabs(exact) * 0x1p-24;
+		err[0][i] = d > 0 ? (float) d : 0;
+	}
+}
+
+static struct sweep sweeps[] = {
+	{ { "lfo sinewave" }, 0, 0, 0, 0, 0, lfo_sinewave_block },
+	{ { "lfo triangle" }, 0, 0, 0, 0, 0x1p-23, lfo_triangle_block },
+	{ { "lfo sawtooth" }, 0, 0, 0, 0, 0x1p-23, lfo_sawtooth_block },
+	{ { "fastsincos sin", "fastsincos cos" }, 0, 0x3f800000, 1, 0, 0, fastsincos_block },
+	{ { "fast_exp2 x>=0" }, 0, 0x3f800000, 1, 0, 2e-7, fast_exp2_block },
+	{ { "fast_exp2 x<=0" }, 0, 0x3f800000, 1, 0x80000000, 2e-7, fast_exp2_block },
+	{ { "fast_log2 (+1ulp)" }, 0x00800000, 0x7f800000, 1, 0, 2e-7, fast_log2_block },
+};
+
+static void merge(struct result *r, double max, double sum, u32 worst)
+{
+	r->sum += sum;
+	if (max > r->max || (max == r->max && worst < r->worst)) {
+		r->max = max;
+		r->worst = worst;
+	}
+}
+
+SWEEP_KERNEL
+static void do_chunk(struct worker *w, int j)
+{
+	const struct sweep *s = sweeps;
+	int nr;
+
+	while (j >= s->job + s->jobs)
+		s++;
+	nr = s->name[1] ? 2 : 1;
+
+	u32 code = s->first + (j - s->job) * CHUNK;
+	for (u32 pos = 0; pos < CHUNK; pos += BLOCK, code += BLOCK) {
+		s->block(w, s, code, w->err);
+		for (int k = 0; k < nr; k++) {
+			const float *err = w->err[k];
+			struct result *r = w->res + 2*(s - sweeps) + k;
+			double max = 0, sum = 0;
+
+			for (int i = 0; i < BLOCK; i++) {
+				double e = err[i];
+				sum += e * e;
+				max = e > max ? e : max;
+			}
+			u32 worst = code;
+			if (max >= r->max) {
+				for (int i = 0; i < BLOCK; i++) {
+					if (err[i] == max) {
+						worst = code + i;
+						break;
+					}
+				}
+			}
+			merge(r, max, sum, worst);
+		}
+	}
+}
+
+static void *sweep_worker(void *arg)
+{
+	struct worker *w = arg;
+	unsigned int j;
+
+	// Like convert: the tiny phases would be all denormals otherwise
+	denormals_off();
+	while ((j = atomic_fetch_add(&next_job, 1)) < nr_jobs)
+		do_chunk(w, j);
+	return NULL;
+}
+
+static void make_jobs(int argc, char **argv, int first)
+{
+	for (int i = 0; i < nr_sweeps; i++) {
+		struct sweep *s = sweeps + i;
+
+		s->wanted = first >= argc;
+		for (int k = first; k < argc; k++)
+			s->wanted |= !strncmp(s->name[0], argv[k], strlen(argv[k]));
+
+		// 'end' of zero is all of the 32 bits
+		s->job = nr_jobs;
+		s->jobs = s->wanted ? (int) (((u64) (s->end ? s->end : TWO_POW_32) - s->first) / CHUNK) : 0;
+		nr_jobs += s->jobs;
+	}
+}
+
+static int report(struct worker *workers, int nr_workers)
+{
+	int err = 0;
+
+	for (int i = 0; i < nr_sweeps; i++) {
+		const struct sweep *s = sweeps + i;
+		u64 count = (u64) s->jobs * CHUNK;
+
+		if (!s->wanted)
+			continue;
+		for (int k = 0; k < 2 && s->name[k]; k++) {
+			struct result r = { 0 };
+			char where[32];
+
+			for (int n = 0; n < nr_workers; n++) {
+				const struct result *p = workers[n].res + 2*i + k;
+				merge(&r, p->max, p->sum, p->worst);
+			}
+			if (s->is_float)
+				snprintf(where, sizeof(where), "%.9g", bits_float(r.worst | s->sign));
+			else
+				snprintf(where, sizeof(where), "%u", r.worst);
+
+			int bad = r.max > s->limit;
+			printf("%-18s max %.3g rms %.3g at %s (limit %.3g)%s\n",
+				s->name[k], r.max, sqrt(r.sum / count), where, s->limit,
+				bad ? " FAILED" : "");
+			err |= bad;
+		}
+	}
+	return err;
+}
+
+// lfo_fill() and lfo_fill_fm() have to match lfo_step() exactly
+static int check_fill(enum lfo_type type)
+{
+	struct lfo_state a = { .idx = 0x12345678, .step = 0x00abcdef }, b = a;
+	float block[1000], step[1000];
+	int bad = 0;
+
+	lfo_fill(&b, type, block, 1000);
+	for (int i = 0; i < 1000; i++)
+		bad |= block[i] != lfo_step(&a, type);
+
+	for (int i = 0; i < 1000; i++)
+		step[i] = 1000.5f * i;
+	lfo_fill_fm(&b, type, step, block, 1000);
+	for (int i = 0; i < 1000; i++) {
+		set_lfo_step(&a, step[i]);
+		bad |= block[i] != lfo_step(&a, type);
+	}
+	bad |= a.idx != b.idx || a.step != b.step;
+
+	if (bad)
+		printf("LFO type %d block fill mismatch\n", type);
+	return bad;
+}
 
 int main(int argc, char **argv)
 {
-	float maxerr = 0;
-	u32 maxidx = 0;
-
-	// This checks every 2**32 value and can be very slow.
-	// Only run on a fast machine
-	lfo.step = 1;
-	do {
-		u32 idx = lfo.idx;
-		float val = lfo_step(&lfo, lfo_sinewave);
-		float s = (idx / TWO_POW_32) * 2 * M_PI;
-		float exact = sin(s);
-		float err = fabs(val - exact);
-		if (err > maxerr) {
-			maxerr = err;
-			maxidx = idx;
+	struct timespec start, end;
+	int nr_workers = sysconf(_SC_NPROCESSORS_ONLN), first = 1, err = 0;
+
+	if (argc > 1 && !strncmp(argv[1], "--threads=", 10)) {
+		nr_workers = atoi(argv[1] + 10);
+		first++;
+	}
+	if (nr_workers < 1)
+		nr_workers = 1;
+
+	// The rest of the sweeps go through the _fill() versions
+	for (int type = lfo_sinewave; type <= lfo_sawtooth; type++)
+		err |= check_fill(type);
+
+	two_pi = 8 * atan(1);
+	nr_sweeps = ARRAY_SIZE(sweeps);
+	sweeps[0].limit = SINE_LIMIT;
+	sweeps[3].limit = SINE_LIMIT;
+	make_jobs(argc, argv, first);
+
+	for (int i = 0; i < BLOCK; i++)
+		offset[i] = i;
+	log2_mantissa = malloc((1 << 23) * sizeof(double));
+	if (!log2_mantissa) {
+		perror("malloc");
+		exit(1);
+	}
+	for (int i = 0; i < 1 << 23; i++)
+		log2_mantissa[i] = log2(1 + (double) i * 0x1p-23);
+
+	struct worker *workers = calloc(nr_workers, sizeof(*workers));
+	struct result *res = calloc(nr_workers * 2 * nr_sweeps, sizeof(*res));
+	if (!workers || !res) {
+		perror("calloc");
+		exit(1);
+	}
+
+	printf("QUARTER_SINE_STEP_SHIFT %d (%d steps, %s)\n", QUARTER_SINE_STEP_SHIFT, QUARTER_SINE_STEPS, SINE_LOOKUP);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < nr_workers; i++) {
+		workers[i].res = res + i * 2 * nr_sweeps;
+		if (pthread_create(&workers[i].thread, NULL, sweep_worker, workers+i)) {
+			fprintf(stderr, "Can't create worker thread\n");
+			exit(1);
 		}
-	} while (lfo.idx);
+	}
+	for (int i = 0; i < nr_workers; i++)
+		pthread_join(workers[i].thread, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
 
-	printf("Max LFO sinewave error %.8f at %u\n", maxerr, maxidx);
-	return 0;
+	err |= report(workers, nr_workers);
+	printf("%d chunks of %u on %d thread(s) in %.1f s\n", nr_jobs, CHUNK, nr_workers,
+		(end.tv_sec - start.tv_sec) + (double) (end.tv_nsec - start.tv_nsec) / 1000000000);
+	return err;
 }
@@ -1,7 +1,6 @@
 #include <math.h>
 #include <stdio.h>
-
-#define SAMPLES_PER_SEC 48000.0f
+#include <stdlib.h>
 
 typedef unsigned int uint;
 #include "../util.h"
@@ -0,0 +1,176 @@
+//
+// Where the time goes in the normal (live) render, built in with
+// 'make TIMING=1' (-DTIMING). Without it everything here is empty
+// and there isn't so much as a clock read left in the render.
+//
+// Every block gets its DSP time (the whole of render_block()) against
+// its deadline, which is just how long its samples take to play: 200
+// samples are 4.17ms at 48kHz. On top of that
+//
+//	stages	the time in each effect of the chain, when they run
+//		a block at a time (the step functions all go sample by
+//		sample through the whole chain, so they only show up in
+//		the total)
+//	read	waiting for input, ie the pipe from ffmpeg or whatever
+//	write	waiting on the output, which is normally ffplay pacing
+//		us at the real-time rate
+//
+// 'misses' are the blocks where the DSP alone took longer than the
+// deadline, which nothing but a faster chain fixes. 'late' ones are
+// where the DSP and the I/O together did, which with a pipe to ffplay
+// can just be the scheduler: if that count goes up but 'misses'
+// doesn't, the DSP isn't to blame.
+//
+// The block times also go in a histogram of power-of-two buckets
+// in microseconds. It's all dumped to stderr at exit, and on SIGUSR1:
+//
+//	kill -USR1 $(pidof convert)
+//
+// That only sets a flag, and the dump then happens after the next
+// block, in the audio thread (so under ALSA that block is late).
+// The numbers are from the start, not since the last dump. ALSA and
+// file to file renders only have the DSP side, there's no read or
+// write to wait on.
+//
+#define TIMING_BUCKETS 16
+
+#ifdef TIMING
+
+struct timing {
+	u64 blocks, samples, misses, late;
+	u64 dsp, dsp_max, deadline;
+	u64 read, read_max, write, write_max;
+	u64 io, last, last_deadline;	// for the block being rendered
+	u64 stage[MAX_CHAIN];
+	u64 hist[TIMING_BUCKETS];
+};
+
+static struct timing live_timing;
+static volatile sig_atomic_t timing_wanted;
+
+static inline u64 timing_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void timing_dump(struct render *r)
+{
+	struct timing *t = r->timing;
+	u64 blocks = t->blocks ? t->blocks : 1;
+
+	fprintf(stderr, "timing: %llu blocks, %llu samples, %.1f%% of real time in the DSP\n",
+		t->blocks, t->samples, t->deadline ? 100 * (double) t->dsp / t->deadline : 0);
+	fprintf(stderr, "  dsp\tavg %8.1fus max %8.1fus, %llu misses, %llu late\n",
+		(double) t->dsp / blocks / 1000, (double) t->dsp_max / 1000, t->misses, t->late);
+	fprintf(stderr, "  read\tavg %8.1fus max %8.1fus\n",
+		(double) t->read / blocks / 1000, (double) t->read_max / 1000);
+	fprintf(stderr, "  write\tavg %8.1fus max %8.1fus\n",
+		(double) t->write / blocks / 1000, (double) t->write_max / 1000);
+	for (int j = 0; j < r->chain_len; j++)
+		if (t->stage[j])
+			fprintf(stderr, "  %s\tavg %8.1fus\n", r->chain[j].eff->name,
+				(double) t->stage[j] / blocks / 1000);
+
+	fprintf(stderr, "  deadline avg %.1fus, dsp times:\n", (double) t->deadline / blocks / 1000);
+	for (int i = 0; i < TIMING_BUCKETS; i++) {
+		if (!t->hist[i])
+			continue;
+		if (!i)
+			fprintf(stderr, "         ..     1us %llu\n", t->hist[i]);
+		else if (i < TIMING_BUCKETS-1)
+			fprintf(stderr, "  %6uus ..%6uus %llu\n", 1u << (i-1), 1u << i, t->hist[i]);
+		else
+			fprintf(stderr, "  %6uus ..         %llu\n", 1u << (i-1), t->hist[i]);
+	}
+}
+
+static void timing_signal(int sig)
+{
+	timing_wanted = 1;
+}
+
+static void timing_exit(void)
+{
+	timing_dump(&live);
+}
+
+static void timing_setup(struct render *r)
+{
+	r->timing = &live_timing;
+	signal(SIGUSR1, timing_signal);
+	atexit(timing_exit);
+}
+
+static inline void timing_stage(struct render *r, int j, u64 start)
+{
+	if (r->timing)
+		r->timing->stage[j] += timing_now() - start;
+}
+
+static inline void timing_read(struct render *r, u64 start)
+{
+	struct timing *t = r->timing;
+	u64 ns = timing_now() - start;
+
+	t->read += ns;
+	t->io = ns;
+	if (ns > t->read_max)
+		t->read_max = ns;
+}
+
+static inline void timing_write(struct render *r, u64 start)
+{
+	struct timing *t = r->timing;
+	u64 ns = timing_now() - start;
+
+	t->write += ns;
+	t->io += ns;
+	if (ns > t->write_max)
+		t->write_max = ns;
+	if (t->io + t->last > t->last_deadline)
+		t->late++;
+}
+
+static inline void timing_block(struct render *r, int nr, u64 start)
+{
+	struct timing *t = r->timing;
+
+	if (!t)
+		return;
+
+	u64 ns = timing_now() - start;
+	u64 deadline = (u64) nr * 1000000000 / (u64) SAMPLES_PER_SEC;
+	u64 us = ns / 1000;
+	int bucket = us ? 64 - __builtin_clzll(us) : 0;
+
+	t->blocks++;
+	t->samples += nr;
+	t->dsp += ns;
+	t->deadline += deadline;
+	t->last = ns;
+	t->last_deadline = deadline;
+	if (ns > t->dsp_max)
+		t->dsp_max = ns;
+	if (ns > deadline)
+		t->misses++;
+	t->hist[bucket < TIMING_BUCKETS ? bucket : TIMING_BUCKETS-1]++;
+
+	if (timing_wanted) {
+		timing_wanted = 0;
+		timing_dump(r);
+	}
+}
+
+#else
+
+static inline u64 timing_now(void) { return 0; }
+static inline void timing_setup(struct render *r) { }
+static inline void timing_stage(struct render *r, int j, u64 start) { }
+static inline void timing_read(struct render *r, u64 start) { }
+static inline void timing_write(struct render *r, u64 start) { }
+static inline void timing_block(struct render *r, int nr, u64 start) { }
+
+#endif
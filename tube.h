@@ -20,7 +20,9 @@
 // exponential in the incoming signal with a bias voltage
 //
 // I then apply a FIR filter (you need to get that FIR.raw from
-// somewhere) with a completely random multiplier.
+// somewhere, it runs without it otherwise) with a completely random
+// multiplier. It can be any length, and another one can be picked
+// with 'convert --ir=FILE'. See ir.h for how it's loaded.
 //
 // It's all very ridiculous, in other words. Do I look like I know
 // what I'm doing?
@@ -34,80 +36,134 @@
 // So this violates the whole point of this project, but I wanted to
 // at least see what it would look like.
 //
+// The FIR goes through the partitioned convolver, which at least
+// makes it cheap enough on a PC: only the first TUBE_PARTITION taps
+// are done sample by sample.
+//
+// The 1.5 power curve goes through the table-driven waveshaper
+// with the boost as the pre-gain (and can be oversampled with
+// TUBE_OVERSAMPLE=2 or 4 at build time).
+//
+// Build with TUBE_TONECTRL=0 to leave out the tone control. Whether
+// there is a FIR is only known at init time, which picks the block
+// function that has just the stages in use.
+//
+#define TUBE_PARTITION 64
+
+#ifndef TUBE_OVERSAMPLE
+  #define TUBE_OVERSAMPLE 1
+#endif
+#ifndef TUBE_TONECTRL
+  #define TUBE_TONECTRL 1
+#endif
+
+// Boost goes up to 20x
+#define TUBE_RANGE 32
 
-static struct {
+struct tube_state {
 	float boost, volume;
 	float lf, hf;
-	struct biquad bass, treble;
-	union {
-		s32 i;
-		float f;
-	} FIR[1024];
-	int nr, loaded;
-	float data[1024];
-} tube;
+	struct biquad_bank tone;	// bass, then treble
+	struct convolver fir;
+	struct waveshaper shaper;
+	int loaded, has_fir;
+	EFFECT_VARIANT(tube);
+};
 
-static inline void tube_describe(float pot[4])
+static float tube_curve(float in)
+{
+	if (in+1 > 0) {
+		// (in+1)**1.5 without going through pow()
+		float x = in + 1;
+		return x * sqrtf(x) - 1;
+	}
+	return -1;
+}
+
+// NULL for none at all
+static const char *tube_ir = "FIR.raw";
+
+static void tube_load_fir(struct tube_state *tube)
+{
+	if (waveshaper_init(&tube->shaper, TUBE_OVERSAMPLE)) {
+		fprintf(stderr, "Out of memory for waveshaper\n");
+		exit(1);
+	}
+	waveshaper_bake(&tube->shaper, tube_curve, TUBE_RANGE);
+	tube->loaded = 1;
+	tube->has_fir = tube_ir && ir_load(&tube->fir, tube_ir, TUBE_PARTITION) > 0;
+}
+
+// Everything between the curve and the FIR
+static inline void tube_tone(struct tube_state *tube, float *buf, int n)
+{
+	for (int i = 0; i < n; i++)
+		buf[i] *= tube->volume;
+
+	if (TUBE_TONECTRL)
+		biquad_bank_cascade(&tube->tone, buf, n);
+}
+
+// 'fir' is a constant in each of the variants below
+static inline __attribute__((always_inline))
+void tube_run(struct tube_state *tube, const float *in, float *out, int n, const int fir)
 {
-	if (!tube.loaded) {
-		int fd = open("FIR.raw", O_RDONLY);
-		if (fd < 0) {
-			perror("FIR.raw");
-			exit(1);
-		}
-		int n = read(fd, tube.FIR, sizeof(tube.FIR));
-		if (n < 0) {
-			perror("FIR.raw");
-			exit(1);
-		}
-		close(fd);
-
-		for (int i = 0; i < n / 4; i++)
-			tube.FIR[i].f = tube.FIR[i].i / 2147483648.0;
-
-		tube.loaded = 1;
+	waveshaper_block(&tube->shaper, in, out, n);
+	tube_tone(tube, out, n);
+
+	if (fir) {
+		// I need to figure out what the proper thing here is
+		convolver_block(&tube->fir, out, out, n);
+		for (int i = 0; i < n; i++)
+			out[i] /= 10;
 	}
+}
+
+static void tube_without_fir(struct tube_state *tube, const float *in, float *out, int n)
+{
+	tube_run(tube, in, out, n, 0);
+}
+
+static void tube_with_fir(struct tube_state *tube, const float *in, float *out, int n)
+{
+	tube_run(tube, in, out, n, 1);
+}
+
+static inline void tube_describe(float pot[4])
+{
 	fprintf(stderr, " volume=%g", cubic(pot[0], 0.1, 2));
 	fprintf(stderr, " boost=%g", linear(pot[1], 1, 20));
 	fprintf(stderr, " lf=%.0f Hz", pot_frequency(pot[2]/2));
 	fprintf(stderr, " hf=%.0f Hz\n", pot_frequency(0.5+pot[3]));
 }
 
-static inline void tube_init(float pot[4])
+static inline void tube_init(struct tube_state *tube, float pot[4])
 {
+	if (!tube->loaded)
+		tube_load_fir(tube);
+
 	// I need to think more about this
-	tube.volume = cubic(pot[0], 0.1, 2);
-	tube.boost = linear(pot[1], 1, 20);
-	tube.lf = pot_frequency(pot[2]/2);
-	tube.hf = pot_frequency(0.5+pot[3]);
+	tube->volume = cubic(pot[0], 0.1, 2);
+	tube->boost = linear(pot[1], 1, 20);
+	tube->lf = pot_frequency(pot[2]/2);
+	tube->hf = pot_frequency(0.5+pot[3]);
 
-	biquad_hpf(&tube.bass, tube.lf, 1);
-	biquad_lpf(&tube.treble, tube.hf, 1);
+	biquad_bank_hpf(&tube->tone, 0, tube->lf, 1);
+	biquad_bank_lpf(&tube->tone, 1, tube->hf, 1);
+	waveshaper_set_gain(&tube->shaper, tube->boost);
+
+	tube->variant = tube->has_fir ? tube_with_fir : tube_without_fir;
 }
 
-static float tube_step(float in)
+static inline void tube_fini(struct tube_state *tube)
 {
-	in *= tube.boost;
-	if (in+1 > 0)
-		in = (float)pow(in + 1, 1.5)-1;
-	else
-		in = -1;
-	in *= tube.volume;
-
-#if 1 // ENABLE_TONECTRL
-	in = biquad_step(&tube.bass, in);
-	in = biquad_step(&tube.treble, in);
-#endif
-
-#if 1 // ENABLE_FIR
-	tube.data[++tube.nr & 1023] = in;
-	float sum = 0;
-	for (int i = 0; i < 1024; i++)
-		sum += tube.FIR[i].f * tube.data[(tube.nr-i)&1023];
-
-	// I need to figure out what the proper thing here is
-	in = sum / 10;
-#endif
-
-	return in;
+	if (!tube->loaded)
+		return;
+	waveshaper_free(&tube->shaper);
+	if (tube->has_fir)
+		convolver_free(&tube->fir);
 }
+
+VARIANT_TO_BLOCK(tube)
+EFFECT_FINI(tube)
+DEFINE_EFFECT(tube, .fini = tube_fini_fn);
@@ -8,11 +8,11 @@
 // available in all environments, so you end up with a mess of
 // configuration), and 'uint' as not having a well-defined size.
 //
-// I'm not using the 64-bit types yet, but the RP2354 has 32x32
-// multiplies giving a 64-bit result, so I'm considering doing
-// some fixed-point math, and this preps for it.
+// The 64-bit types are for fixed-point math: the RP2354 has 32x32
+// multiplies giving a 64-bit result. See the Q31 helpers below.
 //
 typedef int s32;
+typedef unsigned short u16;
 typedef unsigned int u32;
 typedef long long s64;
 typedef unsigned long long u64;
@@ -22,7 +22,8 @@ typedef unsigned long long u64;
 #define TWO_POW_32 (4294967296.0f)
 #define LN2 0.69314718055994530942
 
-#define pow2(x) (float)pow(2,x)
+// See fast_exp2() below
+#define pow2(x) fast_exp2(x)
 
 // Turn 0..1 into a range
 #define linear(pot, a, b)	((a)+(pot)*((b)-(a)))
@@ -49,38 +50,497 @@ static inline u32 fraction_to_u32(float val)
 	return (u32) (val * TWO_POW_32);
 }
 
-// Max ~1.25s delays at ~52kHz
-#define SAMPLE_ARRAY_SIZE 65536
-#define SAMPLE_ARRAY_MASK (SAMPLE_ARRAY_SIZE-1)
-extern float sample_array[SAMPLE_ARRAY_SIZE];
-extern int sample_array_index;
+//
+// Q31 fixed-point
+//
+// A Q31 value is an s32 with 31 fractional bits, so -1 .. 1-2**-31,
+// which is exactly the sample format convert reads and writes.
+// Multiplies are 32x32->64 and shift back down.
+//
+// Anything that can go above full scale internally (filters with
+// gain, feedback sums) works on samples shifted down by
+// FIXED_HEADROOM bits instead, ie Q2.29 with x4 of headroom.
+//
+// Building with FIXED_POINT defined keeps the samples in Q31 through
+// the chain, and switches the delay lines below to Q31 storage.
+//
+typedef s32 q31;
+
+#define FIXED_HEADROOM 2
+#define Q31(x) ((q31) ((x) * 2147483648.0))
+
+// Saturate a 64-bit intermediate result to 32 bits
+static inline s32 q31_sat(s64 x)
+{
+	if (x > 0x7fffffff)
+		return 0x7fffffff;
+	if (x < -0x7fffffff-1)
+		return -0x7fffffff-1;
+	return (s32) x;
+}
+
+static inline q31 float_to_q31(float x)
+{
+	if (x >= 1)
+		return 0x7fffffff;
+	if (x <= -1)
+		return -0x7fffffff-1;
+	return (q31) (x * 2147483648.0f);
+}
+
+static inline float q31_to_float(q31 x)
+{
+	return x * (1.0f / 2147483648.0f);
+}
+
+static inline q31 q31_mul(q31 a, q31 b)
+{
+	return (q31) (((s64) a * b) >> 31);
+}
+
+// a + (b-a)*frac, with 'frac' in 0 .. 1
+static inline q31 q31_lerp(q31 a, q31 b, q31 frac)
+{
+	return a + (q31) ((((s64) b - a) * frac) >> 31);
+}
+
+//
+// limit_value() of a Q31 value that may have overflowed into
+// 64 bits. The divide is cheaper done in float even on the
+// RP2354, which has a single-precision FPU but no 64-bit divide.
+//
+static inline q31 q31_limit(s64 x)
+{
+	return float_to_q31(limit_value(x * (1.0f / 2147483648.0f)));
+}
+
+//
+// Denormals
+//
+// Anything with feedback (filter state, delay lines) decays
+// exponentially once the input goes quiet, and the last stretch of
+// that is in denormal floats, which are many times slower to compute
+// with on x86 in particular. That's exactly when we don't expect load.
+//
+// denormals_off() makes the FPU flush them to zero for the calling
+// thread: FTZ and DAZ on x86, FZ on ARM. Where there's no such mode,
+// or when built with DENORMAL_FALLBACK, flush_denormal() does it by
+// hand where things feed back: the biquad output and the delay line
+// write. Anything below 1e-30 (-600dB) is silence for our purposes.
+//
+#if !defined(DENORMAL_FALLBACK) && (defined(__SSE__) || defined(__aarch64__) || defined(__ARM_FP))
+  #define DENORMAL_HW
+#endif
+
+// Returns non-zero if the hardware does it
+static inline int denormals_off(void)
+{
+#if !defined(DENORMAL_HW)
+	return 0;
+#elif defined(__SSE__)
+	__builtin_ia32_ldmxcsr(__builtin_ia32_stmxcsr() | 0x8040);
+	return 1;
+#elif defined(__aarch64__)
+	u64 fpcr;
+	__asm__ volatile("mrs %0, fpcr" : "=r" (fpcr));
+	__asm__ volatile("msr fpcr, %0" : : "r" (fpcr | (1 << 24)));
+	return 1;
+#else
+	u32 fpscr;
+	__asm__ volatile("vmrs %0, fpscr" : "=r" (fpscr));
+	__asm__ volatile("vmsr fpscr, %0" : : "r" (fpscr | (1 << 24)));
+	return 1;
+#endif
+}
+
+static inline float flush_denormal(float x)
+{
+#ifdef DENORMAL_HW
+	return x;
+#else
+	return fabsf(x) < 1e-30f ? 0 : x;
+#endif
+}
+
+//
+// Delay lines
+//
+// Each delay line is a power-of-two ring buffer so that the index
+// can just be masked, sized for the longest delay the effect needs.
+// They are carved out of one static arena, so a short delay (a
+// flanger) only touches a few cache lines and the common case has no
+// malloc at all.
+//
+// DELAY_ARENA_SIZE is the static arena: 2**16 samples is 256kB of
+// float, the same as the single delay line there used to be, and
+// exactly one echo at 48kHz. It can be made smaller on the RP2354.
+// Whatever doesn't fit (more channels, a longer chain, a higher
+// rate) gets malloc'ed in chunks of at least that size. That only
+// happens when an effect first gets its delay line, and they all go
+// back with delay_arena_reset().
+//
+// The arena is per thread: every thread uses the static one unless
+// it has given itself another with delay_arena_use(), so that
+// several renders can set up their effects at the same time.
+//
+#ifndef DELAY_ARENA_SIZE
+  #define DELAY_ARENA_SIZE (1 << 16)
+#endif
+
+#ifdef FIXED_POINT
+typedef q31 delay_sample;
+#else
+typedef float delay_sample;
+#endif
+
+struct delay_arena {
+	delay_sample *data;
+	unsigned int size, used;
+	delay_sample *base;		// what a reset goes back to
+	unsigned int base_size;
+	struct delay_chunk *chunks;	// the malloc'ed ones
+};
+
+// The samples follow, still 64-byte aligned
+struct delay_chunk {
+	struct delay_chunk *next;
+} __attribute__((aligned(64)));
+
+static delay_sample delay_arena_static[DELAY_ARENA_SIZE] __attribute__((aligned(64)));
+static _Thread_local struct delay_arena delay_arena = {
+	.data = delay_arena_static,
+	.size = DELAY_ARENA_SIZE,
+	.base = delay_arena_static,
+	.base_size = DELAY_ARENA_SIZE,
+};
+
+// Carry on in a new chunk with room for at least 'size' samples
+static inline int delay_arena_grow(unsigned int size)
+{
+	struct delay_chunk *chunk;
+
+	if (size < DELAY_ARENA_SIZE)
+		size = DELAY_ARENA_SIZE;
+	chunk = aligned_alloc(64, sizeof(*chunk) + size * sizeof(delay_sample));
+	if (!chunk)
+		return -1;
+	chunk->next = delay_arena.chunks;
+	delay_arena.chunks = chunk;
+	delay_arena.data = (delay_sample *) (chunk + 1);
+	delay_arena.size = size;
+	delay_arena.used = 0;
+	return 0;
+}
+
+struct sample_array {
+	delay_sample *data;
+	u32 mask;
+	u32 index;
+};
+
+//
+// Room for delays up to 'max' samples (plus one for the
+// interpolation). Returns non-zero if it's out of memory.
+//
+static inline int sample_array_init(struct sample_array *sa, int max)
+{
+	unsigned int size = 64;
+
+	while (size < max + 2)
+		size <<= 1;
+	if (size > delay_arena.size - delay_arena.used && delay_arena_grow(size))
+		return -1;
+
+	sa->data = delay_arena.data + delay_arena.used;
+	for (unsigned int i = 0; i < size; i++)
+		sa->data[i] = 0;
+	sa->mask = size - 1;
+	sa->index = 0;
+	delay_arena.used += size;
+	return 0;
+}
+
+// Give everything back, for when all the effect state is freed
+static inline void delay_arena_reset(void)
+{
+	while (delay_arena.chunks) {
+		struct delay_chunk *next = delay_arena.chunks->next;
+		free(delay_arena.chunks);
+		delay_arena.chunks = next;
+	}
+	delay_arena.data = delay_arena.base;
+	delay_arena.size = delay_arena.base_size;
+	delay_arena.used = 0;
+}
+
+// Allocate from 'size' samples at 'data' in this thread from now on
+// (or with a NULL 'data', from malloc'ed chunks only)
+static inline void delay_arena_use(delay_sample *data, unsigned int size)
+{
+	delay_arena_reset();
+	delay_arena.base = data;
+	delay_arena.base_size = size;
+	delay_arena_reset();
+}
+
+// The longest delay it can do
+static inline int sample_array_max(const struct sample_array *sa)
+{
+	return sa->mask - 1;
+}
+
+//
+// The sample rate is set at run time (convert --rate), and everything
+// that depends on it is worked out once in set_sample_rate(), so that
+// the effects never divide by it. It starts out as 48kHz.
+//
+// The envelope tracking and the noise gate in process.h are tuned for
+// 48kHz, so their per-sample constants get scaled to keep the same
+// times at other rates.
+//
+struct sample_rate {
+	float sec, msec;	// samples per second and per millisecond
+	float period;		// 1 / samples per second
+	float f_step;		// LFO step for 1Hz, see lfo.h
+	int envelope_shift;	// see process_gate()
+	float gate_up, gate_down;
+	s32 gate_step_q31;
+};
+
+static struct sample_rate sample_rate = {
+	.sec = 48000, .msec = 48000 * 0.001f, .period = 1 / 48000.0f,
+	.f_step = TWO_POW_32 / 48000,
+	.envelope_shift = 12,
+	.gate_up = 1.001, .gate_down = 0.999,
+	.gate_step_q31 = (s32) (0.001 * 2147483648.0),
+};
+
+#define SAMPLES_PER_SEC (sample_rate.sec)
+#define SAMPLES_PER_MSEC (sample_rate.msec)
+#define SAMPLE_PERIOD (sample_rate.period)
+
+//
+// Only call this before setting up any effects (and before starting
+// any threads). Returns non-zero for a rate it can't do.
+//
+static inline int set_sample_rate(unsigned int rate)
+{
+	struct sample_rate *r = &sample_rate;
+	double ratio = rate / 48000.0;
+
+	if (rate < 8000 || rate > 768000)
+		return -1;
+
+	r->sec = (float) rate;
+	r->msec = r->sec * 0.001f;
+	r->period = 1 / r->sec;
+	r->f_step = TWO_POW_32 / r->sec;
+
+	// Same envelope half-life and gate ramp times as at 48kHz
+	r->envelope_shift = 12 + (int) lrint(log2(ratio));
+	r->gate_up = (float) pow(1.001, 1 / ratio);
+	r->gate_down = (float) pow(0.999, 1 / ratio);
+	r->gate_step_q31 = (s32) (0.001 / ratio * 2147483648.0);
+	return 0;
+}
+
+//
+// Reading at 'delay' gives the sample written that many writes ago,
+// interpolated towards the one after it. The block versions below do
+// 'n' reads interleaved with 'n' writes in one go, so the caller has
+// to keep 'n' no larger than the (integer part of the) shortest delay:
+// then none of the reads can see any of the writes.
+//
+// The constant-delay read and the block write only deal with the ring
+// wrapping around at its end, and are plain loops over contiguous
+// samples otherwise. The modulated-delay gather has to mask every
+// index, but doesn't depend on 'sa->index' changing under it.
+//
+#ifdef FIXED_POINT
+
+static inline void sample_array_write_q31(struct sample_array *sa, q31 val)
+{
+	u32 idx = sa->mask & ++sa->index;
+	sa->data[idx] = val;
+}
+
+// The fractional delay becomes a Q31 interpolation factor
+static inline q31 sample_array_read_at_q31(const struct sample_array *sa, u32 index, float delay)
+{
+	int i = (int) delay;
+	q31 frac = (q31) ((delay - i) * 2147483648.0f);
+	u32 idx = index - i;
+
+	q31 a = sa->data[sa->mask & idx];
+	q31 b = sa->data[sa->mask & ++idx];
+	return q31_lerp(a, b, frac);
+}
+
+static inline q31 sample_array_read_q31(struct sample_array *sa, float delay)
+{
+	return sample_array_read_at_q31(sa, sa->index, delay);
+}
+
+static inline void sample_array_write_block_q31(struct sample_array *sa, const q31 *in, int n)
+{
+	while (n > 0) {
+		u32 pos = sa->mask & (sa->index + 1);
+		int len = sa->mask + 1 - pos;
+		if (len > n)
+			len = n;
+
+		q31 *p = sa->data + pos;
+		for (int k = 0; k < len; k++)
+			p[k] = in[k];
+		sa->index += len;
+		in += len; n -= len;
+	}
+}
+
+static inline void sample_array_read_block_q31(const struct sample_array *sa, float delay, q31 *out, int n)
+{
+	int i = (int) delay;
+	q31 frac = (q31) ((delay - i) * 2147483648.0f);
+	u32 idx = sa->index - i;
+
+	while (n > 0) {
+		// Both 'p[k]' and 'p[k+1]' have to be inside the ring
+		u32 pos = sa->mask & idx;
+		int len = sa->mask - pos;
+		if (len > n)
+			len = n;
+		if (!len) {
+			*out++ = q31_lerp(sa->data[pos], sa->data[0], frac);
+			idx++; n--;
+			continue;
+		}
+
+		const q31 *p = sa->data + pos;
+		for (int k = 0; k < len; k++)
+			out[k] = q31_lerp(p[k], p[k+1], frac);
+		idx += len;
+		out += len; n -= len;
+	}
+}
+
+static inline void sample_array_gather_q31(const struct sample_array *sa, const float *delay, q31 *out, int n)
+{
+	for (int k = 0; k < n; k++)
+		out[k] = sample_array_read_at_q31(sa, sa->index + k, delay[k]);
+}
+
+// The float interfaces just convert, they are not the fast path here
+static inline void sample_array_write(struct sample_array *sa, float val)
+{
+	sample_array_write_q31(sa, float_to_q31(val));
+}
+
+static inline float sample_array_read(struct sample_array *sa, float delay)
+{
+	return q31_to_float(sample_array_read_q31(sa, delay));
+}
+
+static inline void sample_array_write_block(struct sample_array *sa, const float *in, int n)
+{
+	for (int k = 0; k < n; k++)
+		sample_array_write(sa, in[k]);
+}
+
+static inline void sample_array_read_block(const struct sample_array *sa, float delay, float *out, int n)
+{
+	for (int k = 0; k < n; k++)
+		out[k] = q31_to_float(sample_array_read_at_q31(sa, sa->index + k, delay));
+}
+
+static inline void sample_array_gather(const struct sample_array *sa, const float *delay, float *out, int n)
+{
+	for (int k = 0; k < n; k++)
+		out[k] = q31_to_float(sample_array_read_at_q31(sa, sa->index + k, delay[k]));
+}
+
+#else
 
-static inline void sample_array_write(float val)
+static inline void sample_array_write(struct sample_array *sa, float val)
 {
-	u32 idx = SAMPLE_ARRAY_MASK & ++sample_array_index;
-	sample_array[idx] = val;
+	u32 idx = sa->mask & ++sa->index;
+	sa->data[idx] = flush_denormal(val);
 }
 
-static inline float sample_array_read(float delay)
+static inline float sample_array_read_at(const struct sample_array *sa, u32 index, float delay)
 {
 	int i = (int) delay;
 	float frac = delay - i;
-	int idx = sample_array_index - i;
+	u32 idx = index - i;
 
-	float a = sample_array[SAMPLE_ARRAY_MASK & idx];
-	float b = sample_array[SAMPLE_ARRAY_MASK & ++idx];
+	float a = sa->data[sa->mask & idx];
+	float b = sa->data[sa->mask & ++idx];
 	return a + (b-a)*frac;
 }
 
+static inline float sample_array_read(struct sample_array *sa, float delay)
+{
+	return sample_array_read_at(sa, sa->index, delay);
+}
+
+static inline void sample_array_write_block(struct sample_array *sa, const float *in, int n)
+{
+	while (n > 0) {
+		u32 pos = sa->mask & (sa->index + 1);
+		int len = sa->mask + 1 - pos;
+		if (len > n)
+			len = n;
+
+		float *p = sa->data + pos;
+		for (int k = 0; k < len; k++)
+			p[k] = flush_denormal(in[k]);
+		sa->index += len;
+		in += len; n -= len;
+	}
+}
+
+static inline void sample_array_read_block(const struct sample_array *sa, float delay, float *out, int n)
+{
+	int i = (int) delay;
+	float frac = delay - i;
+	u32 idx = sa->index - i;
+
+	while (n > 0) {
+		// Both 'p[k]' and 'p[k+1]' have to be inside the ring
+		u32 pos = sa->mask & idx;
+		int len = sa->mask - pos;
+		if (len > n)
+			len = n;
+		if (!len) {
+			float a = sa->data[pos], b = sa->data[0];
+			*out++ = a + (b-a)*frac;
+			idx++; n--;
+			continue;
+		}
+
+		const float *p = sa->data + pos;
+		for (int k = 0; k < len; k++)
+			out[k] = p[k] + (p[k+1]-p[k])*frac;
+		idx += len;
+		out += len; n -= len;
+	}
+}
+
+static inline void sample_array_gather(const struct sample_array *sa, const float *delay, float *out, int n)
+{
+	for (int k = 0; k < n; k++)
+		out[k] = sample_array_read_at(sa, sa->index + k, delay[k]);
+}
+
+#endif
+
 // We can calculate sin/cos at the same time using
 // the table lookup. It's "GoodEnough(tm)" and with
 // 256 entries it's good to about 5.3 digits of
-// precision if I tested it right.
+// precision (tests/lfo checks every float phase).
+// See sintable.h for the other table sizes.
 //
 // Don't use this for real work. For audio? It's fine.
-#include "gensin.h"
-
-#define QUARTER_SINE_STEPS (1<< QUARTER_SINE_STEP_SHIFT)
+#include "sintable.h"
 
 struct sincos { float sin, cos; };
 
@@ -92,6 +552,11 @@ struct sincos fastsincos(float phase)
 	phase -= quadrant;
 
 	phase *= QUARTER_SINE_STEPS;
+#ifdef QUARTER_SINE_NEAREST
+	int idx = (int) (phase + 0.5f);
+	float x = quarter_sin[idx];
+	float y = quarter_sin[QUARTER_SINE_STEPS - idx];
+#else
 	int idx = (int) phase;
 	phase -= idx;
 
@@ -105,6 +570,7 @@ struct sincos fastsincos(float phase)
 	b = quarter_sin[idx-1];
 
 	float y = a + (b-a)*phase;
+#endif
 
 	if (quadrant & 1) {
 		float tmp = -x; x = y; y = tmp;
@@ -115,3 +581,76 @@ struct sincos fastsincos(float phase)
 
 	return (struct sincos) { x, y };
 }
+
+//
+// Fast float exp2/log2/pow approximations
+//
+// Plain bit-twiddling of the IEEE exponent plus a short polynomial
+// for the mantissa part, so they inline to a handful of multiplies
+// instead of a libm call. tests/fastmath checks these bounds:
+//
+//  fast_exp2(x): relative error < 2e-7 (a couple of float ulps),
+//		and exact for integer x. x is clamped to -126 .. 127
+//
+//  fast_log2(x): absolute error < 2e-7 plus rounding of the result
+//		(one float ulp), for positive normal x only
+//
+//  fast_pow(x,y): fast_exp2(y*fast_log2(x)), so the relative error
+//		is roughly 2e-7 * (1 + |y*log2(x)|). Positive x only
+//
+union fast_float {
+	float f;
+	u32 i;
+};
+
+static inline float fast_exp2(float x)
+{
+	if (x < -126)
+		x = -126;
+	if (x > 127)
+		x = 127;
+
+	// Round to nearest, so that the fraction is in -0.5 .. 0.5
+	int i = (int)(x + 128.5f) - 128;
+	float f = x - i;
+
+	// Minimax-ish fit for relative error of 2**f
+	float p = 1.321867225e-03f;
+	p = p*f + 9.671698324e-03f;
+	p = p*f + 5.550893024e-02f;
+	p = p*f + 2.402223796e-01f;
+	p = p*f + 6.931468844e-01f;
+	p = p*f + 1;
+
+	union fast_float u = { .i = (u32)(i + 127) << 23 };
+	return p * u.f;
+}
+
+static inline float fast_log2(float x)
+{
+	union fast_float u = { x };
+	int e = (int)((u.i >> 23) & 255) - 127;
+
+	// Mantissa in sqrt(0.5) .. sqrt(2)
+	u.i = (u.i & 0x7fffff) | 0x3f800000;
+	float m = u.f;
+	if (m > 1.41421356f) {
+		m *= 0.5f;
+		e++;
+	}
+
+	// log(m) = 2*atanh(t) = 2*(t + t^3/3 + t^5/5 + ...)
+	// with |t| < 0.172 the t^9 term is below 1e-7
+	float t = (m - 1) / (m + 1);
+	float t2 = t*t;
+	float p = 2.8853900818f/7;
+	p = p*t2 + 2.8853900818f/5;
+	p = p*t2 + 2.8853900818f/3;
+	p = p*t2 + 2.8853900818f;
+	return e + p*t;
+}
+
+static inline float fast_pow(float x, float y)
+{
+	return fast_exp2(y * fast_log2(x));
+}
@@ -12,6 +12,81 @@ INITIAL_WINDOW_SEC = 3600.0
 BYTES_PER_SAMPLE = 4
 # MAX_WIDTH_SEC removed, utilizing self.max_samples instead
 MAX_PLOT_POINTS = 5000   # Maximum points to plot per line
+PEAKS_MAGIC = 0x31534b50 # "PKS1", see peaks.h
+STFT_MAGIC = 0x31465453  # "STF1", see stft.h
+SPECTROGRAM_RANGE_DB = 120
+
+class PeakPyramid:
+    """The min/max levels of a '<file>.peaks' sidecar, each one memory-mapped."""
+    def __init__(self, filename):
+        header = [int(x) for x in np.fromfile(filename, dtype='<u4', count=8)]
+        if len(header) < 8 or header[0] != PEAKS_MAGIC or header[1] != 1:
+            raise ValueError("not a peaks file")
+        _, _, channels, self.shift, levels, _, lo, hi = header
+        if channels != 1:
+            raise ValueError(f"{channels} channels, only mono is supported")
+
+        self.frames = frames = lo | (hi << 32)
+        self.levels = []
+        offset = 32
+        for k in range(levels):
+            width = 1 << (self.shift + k)
+            bins = (frames + width - 1) // width
+            self.levels.append(np.memmap(filename, dtype='<i4', mode='r', offset=offset, shape=(bins, 2)))
+            offset += bins * 8
+
+    def level(self, width):
+        """The coarsest level with bins no wider than 'width' samples, or None."""
+        k = int(width).bit_length() - 1 - self.shift
+        if k < 0 or not self.levels:
+            return None, 0
+        k = min(k, len(self.levels) - 1)
+        return self.levels[k], 1 << (self.shift + k)
+
+def min_max_points(mins, maxs, first, width):
+    """Interleave min/max pairs of bins starting at sample 'first' into plot points."""
+    x = np.repeat(first + np.arange(len(mins), dtype=np.float64) * width, 2)
+    y = np.empty(2 * len(mins), dtype=np.int32)
+    y[0::2] = mins
+    y[1::2] = maxs
+    return x, y
+
+def is_spectrogram(filename):
+    header = np.fromfile(filename, dtype='<u4', count=1)
+    return header.size == 1 and header[0] == STFT_MAGIC
+
+def show_spectrogram(filename, channel=0):
+    """A figure for a 'convert --stft' file, memory-mapped and strided down to MAX_PLOT_POINTS frames."""
+    header = [int(x) for x in np.fromfile(filename, dtype='<u4', count=8)]
+    _, version, window, hop, bins, fmt, channels, rate = header
+    if version != 1:
+        print(f"{filename}: unknown spectrogram version {version}")
+        return
+
+    dtype = np.dtype('<u2' if fmt == 0 else '<f4')
+    frames = (os.path.getsize(filename) - 32) // (bins * channels * dtype.itemsize)
+    if frames < 1:
+        print(f"{filename}: no frames")
+        return
+    mm = np.memmap(filename, dtype=dtype, mode='r', offset=32, shape=(frames, channels, bins))
+
+    step = max(1, frames // MAX_PLOT_POINTS)
+    data = mm[::step, channel, :]
+    db = data / 256.0 - 200 if fmt == 0 else np.asarray(data)
+
+    # Frame 't' is centered on sample t*hop + hop - window/2
+    start = (hop - window / 2) / rate
+    end = start + frames * hop / rate
+    top = np.max(db)
+
+    fig, ax = plt.subplots(figsize=(12, 6))
+    image = ax.imshow(db.T, origin='lower', aspect='auto', cmap='magma',
+                      extent=[start, end, 0, rate / 2],
+                      vmin=top - SPECTROGRAM_RANGE_DB, vmax=top)
+    ax.set_title(f"{os.path.basename(filename)} (window {window}, hop {hop})")
+    ax.set_xlabel("Time (s)")
+    ax.set_ylabel("Frequency (Hz)")
+    fig.colorbar(image, ax=ax, label="dB")
 
 class WaveformVisualizer:
     def __init__(self, filenames, rate, min_zoom_samples=100):
@@ -24,6 +99,7 @@ class WaveformVisualizer:
         self.x_mode = 'Time'
 
         self.mapped_files = []
+        self.pyramids = []
         self.lines = []
         self.max_samples = 0
 
@@ -37,6 +113,19 @@ class WaveformVisualizer:
                 self.max_samples = max(self.max_samples, samples)
             except Exception as e:
                 print(f"Error opening {f}: {e}")
+                continue
+
+            # 'convert --peaks' leaves a min/max pyramid next to it
+            pyramid = None
+            if os.path.exists(f + '.peaks'):
+                try:
+                    pyramid = PeakPyramid(f + '.peaks')
+                    if pyramid.frames != samples:
+                        raise ValueError("out of date")
+                except Exception as e:
+                    print(f"Ignoring {f}.peaks: {e}")
+                    pyramid = None
+            self.pyramids.append(pyramid)
 
         if not self.mapped_files:
             return
@@ -248,7 +337,7 @@ class WaveformVisualizer:
         global_min_y, global_max_y = 2147483647, -2147483648
         has_data = False
 
-        for line, (mm, _) in zip(self.lines, self.mapped_files):
+        for line, (mm, _), pyramid in zip(self.lines, self.mapped_files, self.pyramids):
             if start_sample >= mm.size:
                 line.set_data([], [])
                 continue
@@ -259,6 +348,23 @@ class WaveformVisualizer:
                  line.set_data([], [])
                  continue
 
+            # Zoomed out, plot the min and max of every 'step'
+            # samples so no peaks get lost: straight from the
+            # samples when there aren't too many of them, from
+            # the pyramid otherwise
+            envelope = None
+            if step > 1:
+                envelope = self.get_envelope(mm, pyramid, start_sample, safe_end, step)
+            if envelope is not None:
+                x, y = envelope
+                line.set_data(x, y)
+                line.set_marker("")
+                if y.size:
+                    global_min_y = min(global_min_y, np.min(y))
+                    global_max_y = max(global_max_y, np.max(y))
+                    has_data = True
+                continue
+
             # Strided slice (View into memory map - very fast)
             chunk = mm[start_sample:safe_end:step]
 
@@ -303,6 +409,30 @@ class WaveformVisualizer:
 
         return has_data, global_min_y, global_max_y
 
+    def get_envelope(self, mm, pyramid, start, end, step):
+        """Min/max plot points of mm[start:end], about two per 'step' samples."""
+        shift = pyramid.shift if pyramid else 8
+        if end - start <= MAX_PLOT_POINTS << shift:
+            chunk = mm[start:end]
+            full = (chunk.size // step) * step
+            mins = chunk[:full].reshape(-1, step).min(axis=1)
+            maxs = chunk[:full].reshape(-1, step).max(axis=1)
+            if full < chunk.size:
+                mins = np.append(mins, chunk[full:].min())
+                maxs = np.append(maxs, chunk[full:].max())
+            return min_max_points(mins, maxs, start, step)
+
+        if pyramid is None:
+            return None
+        level, width = pyramid.level(2 * step)
+        if level is None:
+            return None
+
+        # Whole bins, so the edges may show a little more
+        first, last = start // width, (end + width - 1) // width
+        bins = level[first:last]
+        return min_max_points(bins[:, 0], bins[:, 1], first * width, width)
+
     def update_view(self, start_sample, width_samples):
         """Core update logic: loads data and sets limits (Constrained Mode)."""
         if self.navigating: return
@@ -600,9 +730,20 @@ class WaveformVisualizer:
 
 if __name__ == "__main__":
     parser = argparse.ArgumentParser(description="Linux Audio Waveform Visualizer 2026 (mmap)")
-    parser.add_argument('files', nargs='+', help="Input .bin files (int32)")
+    parser.add_argument('files', nargs='+', help="Input .bin files (int32), or .stft spectrograms")
     parser.add_argument('--rate', type=int, default=48000, help="Sample rate (Hz)")
     parser.add_argument('--min-zoom-samples', type=int, default=100, help="Minimum samples to show when zoomed in")
     args = parser.parse_args()
 
-    app = WaveformVisualizer(args.files, args.rate, args.min_zoom_samples)
+    # Spectrograms get a figure each, the rest go in the waveform view
+    waveforms = []
+    for f in args.files:
+        if is_spectrogram(f):
+            show_spectrogram(f)
+        else:
+            waveforms.append(f)
+
+    if waveforms:
+        app = WaveformVisualizer(waveforms, args.rate, args.min_zoom_samples)
+    else:
+        plt.show()
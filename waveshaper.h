@@ -0,0 +1,221 @@
+//
+// Table-driven static waveshaper
+//
+// The curve gets baked into a linearly interpolated table over the
+// input range -range .. range at init time, and anything outside that
+// just gets the end values. The pre-gain ("drive") is applied before
+// the lookup, so changing it doesn't need a new table.
+//
+// Optionally the shaper runs at 2x or 4x the sample rate, using
+// polyphase halfband filters to go up and back down. That costs some
+// two dozen multiply-adds per sample and stage, but keeps the
+// harmonics of a hard clipper from aliasing back down.
+//
+// The filters are linear phase, so it's all a plain delay: 23 samples
+// at 2x (0.48ms at 48kHz), and 34.5 at 4x, where the second stage's
+// 11.5 make it a fractional one. Mixing the output back with the dry
+// signal needs to allow for that, half a sample of it included.
+//
+#define WAVESHAPER_SIZE 4096
+#define WAVESHAPER_CHUNK 64
+
+//
+// Halfband filters have every other tap zero except for the centre
+// one, which is 0.5. So each of up/down sampling is one short FIR on
+// one phase and a plain delay on the other.
+//
+// HALFBAND_TAPS non-zero taps on each side make a 4*HALFBAND_TAPS-1
+// tap filter. Kaiser-windowed sinc, flat to ~20kHz and around -70dB
+// by the new Nyquist at 2x.
+//
+#define HALFBAND_TAPS 12
+#define HALFBAND_DELAY 32	// power of two > HALFBAND_TAPS
+
+struct halfband {
+	struct fir fir;
+	float delay[HALFBAND_DELAY];
+	int pos;
+};
+
+// Modified Bessel function of the first kind, for the Kaiser window
+static double halfband_i0(double x)
+{
+	double sum = 1, term = 1;
+
+	for (int k = 1; k < 30; k++) {
+		term *= (x / (2*k)) * (x / (2*k));
+		sum += term;
+	}
+	return sum;
+}
+
+// The non-zero taps h[c-2T+1], h[c-2T+3] .. h[c+2T-1], scaled by 'gain'
+static int halfband_init(struct halfband *hb, float gain)
+{
+	const double beta = 7;
+	int T = HALFBAND_TAPS, half = 2*T - 1;
+	float taps[2*HALFBAND_TAPS];
+	double sum = 0;
+
+	for (int i = 0; i < 2*T; i++) {
+		int m = 2*i - half;		// odd offsets from centre
+		double r = (double) m / (half + 1);
+		double w = halfband_i0(beta * sqrt(1 - r*r)) / halfband_i0(beta);
+		double h = sin(M_PI * m / 2) / (M_PI * m) * w;
+
+		taps[i] = (float) h;
+		sum += h;
+	}
+
+	// Normalize so that the FIR phase has exactly half the DC gain
+	for (int i = 0; i < 2*T; i++)
+		taps[i] *= (float) (0.5 * gain / sum);
+
+	memset(hb->delay, 0, sizeof(hb->delay));
+	hb->pos = 0;
+	return fir_init(&hb->fir, taps, 2*T);
+}
+
+static inline float halfband_delay(struct halfband *hb, float in, int delay)
+{
+	hb->delay[hb->pos] = in;
+	float out = hb->delay[(hb->pos - delay) & (HALFBAND_DELAY-1)];
+	hb->pos = (hb->pos + 1) & (HALFBAND_DELAY-1);
+	return out;
+}
+
+// 'n' samples in, '2n' out. 'n' must be at most WAVESHAPER_CHUNK
+static void halfband_up(struct halfband *hb, const float *in, float *out, int n)
+{
+	float even[WAVESHAPER_CHUNK];
+
+	fir_block(&hb->fir, in, even, n);
+	for (int i = 0; i < n; i++) {
+		out[2*i] = even[i];
+		out[2*i+1] = halfband_delay(hb, in[i], HALFBAND_TAPS-1);
+	}
+}
+
+// '2n' samples in, 'n' out. 'out' may be the same as 'in'
+static void halfband_down(struct halfband *hb, const float *in, float *out, int n)
+{
+	float even[WAVESHAPER_CHUNK], odd[WAVESHAPER_CHUNK];
+
+	for (int i = 0; i < n; i++) {
+		even[i] = in[2*i];
+		odd[i] = in[2*i+1];
+	}
+	fir_block(&hb->fir, even, out, n);
+	for (int i = 0; i < n; i++)
+		out[i] += 0.5f * halfband_delay(hb, odd[i], HALFBAND_TAPS);
+}
+
+struct waveshaper {
+	float table[WAVESHAPER_SIZE+2];
+	float range, mul, add;
+	int oversample;
+	struct halfband up[2], down[2];
+};
+
+//
+// 'oversample' is 1, 2 or 4. Returns non-zero if it
+// couldn't allocate the filters.
+//
+static int waveshaper_init(struct waveshaper *ws, int oversample)
+{
+	int err = 0;
+
+	ws->oversample = oversample;
+	for (int i = 0; (1 << (i+1)) <= oversample; i++) {
+		err |= halfband_init(&ws->up[i], 2);
+		err |= halfband_init(&ws->down[i], 1);
+	}
+	return err;
+}
+
+static void waveshaper_free(struct waveshaper *ws)
+{
+	for (int i = 0; (1 << (i+1)) <= ws->oversample; i++) {
+		fir_free(&ws->up[i].fir);
+		fir_free(&ws->down[i].fir);
+	}
+}
+
+static void waveshaper_bake(struct waveshaper *ws, float (*curve)(float), float range)
+{
+	for (int i = 0; i <= WAVESHAPER_SIZE; i++)
+		ws->table[i] = curve(range * (2.0f * i / WAVESHAPER_SIZE - 1));
+
+	// Guard entry so that the very end can interpolate too
+	ws->table[WAVESHAPER_SIZE+1] = ws->table[WAVESHAPER_SIZE];
+	ws->range = range;
+}
+
+// The gain applied to the input before the curve
+static inline void waveshaper_set_gain(struct waveshaper *ws, float gain)
+{
+	float scale = WAVESHAPER_SIZE / (2 * ws->range);
+
+	ws->mul = gain * scale;
+	ws->add = ws->range * scale;
+}
+
+static inline float waveshaper_lookup(const struct waveshaper *ws, float x)
+{
+	float pos = x * ws->mul + ws->add;
+
+	if (pos < 0)
+		pos = 0;
+	if (pos > WAVESHAPER_SIZE)
+		pos = WAVESHAPER_SIZE;
+
+	int i = (int) pos;
+	float a = ws->table[i], b = ws->table[i+1];
+	return a + (b-a)*(pos-i);
+}
+
+static inline void waveshaper_run(const struct waveshaper *ws, const float *in, float *out, int n)
+{
+	for (int i = 0; i < n; i++)
+		out[i] = waveshaper_lookup(ws, in[i]);
+}
+
+// 'in' and 'out' may be the same buffer
+static void waveshaper_block(struct waveshaper *ws, const float *in, float *out, int n)
+{
+	float buf[4*WAVESHAPER_CHUNK];
+
+	if (ws->oversample == 1) {
+		waveshaper_run(ws, in, out, n);
+		return;
+	}
+
+	while (n > 0) {
+		int m = n < WAVESHAPER_CHUNK ? n : WAVESHAPER_CHUNK;
+
+		halfband_up(&ws->up[0], in, buf, m);
+		if (ws->oversample == 4) {
+			// The second stage goes from 2m to 4m samples
+			float tmp[2*WAVESHAPER_CHUNK];
+			memcpy(tmp, buf, 2*m * sizeof(float));
+			halfband_up(&ws->up[1], tmp, buf, m);
+			halfband_up(&ws->up[1], tmp+m, buf+2*m, m);
+			waveshaper_run(ws, buf, buf, 4*m);
+			halfband_down(&ws->down[1], buf, buf, m);
+			halfband_down(&ws->down[1], buf+2*m, buf+m, m);
+		} else {
+			waveshaper_run(ws, buf, buf, 2*m);
+		}
+		halfband_down(&ws->down[0], buf, out, m);
+
+		in += m; out += m; n -= m;
+	}
+}
+
+static inline float waveshaper_step(struct waveshaper *ws, float in)
+{
+	if (ws->oversample == 1)
+		return waveshaper_lookup(ws, in);
+	waveshaper_block(ws, &in, &in, 1);
+	return in;
+}